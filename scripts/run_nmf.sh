@@ -4,6 +4,10 @@ host_filename="../../machinefiles/cogtwo"
 data_filename="/home/yuntiand/downloads/imnet_feat.dat"
 is_partitioned=false
 data_format="binary"
+# input can also be sparse, in "libsvm" or "mtx" format, or in the chunked
+# "nmf" format or as a NumPy "npy" array, which can also be used for output.
+# Text, binary and sparse inputs may be compressed by gzip or zstd. Dense
+# input can also be a directory of shards listed by a "manifest" file
 input_data_format=$data_format
 load_cache=false
 cache_dirname="N/A"
@@ -19,6 +23,14 @@ m=21504
 #n=1266734
 n=126673
 dictionary_size=10000
+objective="frobenius"
+max_dictionary_size=0
+dictionary_growth_size=0
+atom_prune_tol=0.0
+sparse_product_density=0.0
+sparse_S_density=0.25
+B_subset_fetch=false
+B_full_fetch_interval=10
 # Optimization parameters
 num_epochs=500
 minibatch_size=100
@@ -29,12 +41,40 @@ num_iter_S_per_minibatch=10
 init_step_size_S=0.001
 step_size_offset_S=0.0
 step_size_pow_S=0.0
+S_optimizer="pgd"
+num_power_iter=10
+S_convergence_tol=0.0
+converged_col_sample_prob=1.0
+sampling_mode="uniform"
+importance_sampling_uniform_mix=0.1
+auto_step_size=false
+auto_step_size_interval=100
+B_optimizer="sgd"
+B_optimizer_granularity="entry"
+adaptive_epsilon=1e-8
+adam_beta1=0.9
+adam_beta2=0.999
+B_variance_reduction="none"
+svrg_refresh_epochs=5
+svrg_anchor_fraction=1.0
 # Evaluation parameters
 num_eval_minibatch=5
 num_eval_samples=100
+early_stop_tol=0.0
+early_stop_window=10
+early_stop_smoothing=0.5
+init_method="random"
+init_sample_fraction=0.1
+nndsvd_rank=0
+random_seed=-1
 
 # System parameters:
 num_worker_threads=4
+X_memory_budget=0.0
+X_block_size=256
+X_cache_path="/tmp"
+X_precision="fp32"
+S_map_file=""
 table_staleness=100
 maximum_running_time=0.0
 
@@ -69,6 +109,16 @@ if [ "$load_cache" = true ]; then
 else
     flag_load_cache="noload_cache"
 fi 
+if [ "$auto_step_size" = true ]; then
+    flag_auto_step_size="auto_step_size"
+else
+    flag_auto_step_size="noauto_step_size"
+fi 
+if [ "$B_subset_fetch" = true ]; then
+    flag_B_subset_fetch="B_subset_fetch"
+else
+    flag_B_subset_fetch="noB_subset_fetch"
+fi 
 
 ssh_options="-oStrictHostKeyChecking=no \
 -oUserKnownHostsFile=/dev/null \
@@ -118,7 +168,20 @@ for ip in $unique_host_list; do
       --output_path $output_path \
       --num_clients $num_unique_hosts \
       --num_worker_threads $num_worker_threads \
+      --X_memory_budget $X_memory_budget \
+      --X_block_size $X_block_size \
+      --X_cache_path $X_cache_path \
+      --X_precision $X_precision \
+      --S_map_file=$S_map_file \
       --dictionary_size $dictionary_size \
+      --objective $objective \
+      --max_dictionary_size $max_dictionary_size \
+      --dictionary_growth_size $dictionary_growth_size \
+      --atom_prune_tol $atom_prune_tol \
+      --sparse_product_density $sparse_product_density \
+      --sparse_S_density $sparse_S_density \
+      --$flag_B_subset_fetch \
+      --B_full_fetch_interval $B_full_fetch_interval \
       --m $m \
       --n $n \
       --num_epochs $num_epochs\
@@ -126,12 +189,35 @@ for ip in $unique_host_list; do
       --num_iter_S_per_minibatch $num_iter_S_per_minibatch \
       --num_eval_minibatch $num_eval_minibatch \
       --num_eval_samples $num_eval_samples \
+      --early_stop_tol $early_stop_tol \
+      --early_stop_window $early_stop_window \
+      --early_stop_smoothing $early_stop_smoothing \
+      --init_method $init_method \
+      --init_sample_fraction $init_sample_fraction \
+      --nndsvd_rank $nndsvd_rank \
+      --random_seed $random_seed \
       --init_step_size_B $init_step_size_B \
       --step_size_offset_B $step_size_offset_B \
       --step_size_pow_B $step_size_pow_B \
       --init_step_size_S $init_step_size_S \
       --step_size_offset_S $step_size_offset_S \
       --step_size_pow_S $step_size_pow_S \
+      --S_optimizer $S_optimizer \
+      --num_power_iter $num_power_iter \
+      --S_convergence_tol $S_convergence_tol \
+      --converged_col_sample_prob $converged_col_sample_prob \
+      --sampling_mode $sampling_mode \
+      --importance_sampling_uniform_mix $importance_sampling_uniform_mix \
+      --$flag_auto_step_size \
+      --auto_step_size_interval $auto_step_size_interval \
+      --B_optimizer $B_optimizer \
+      --B_optimizer_granularity $B_optimizer_granularity \
+      --adaptive_epsilon $adaptive_epsilon \
+      --adam_beta1 $adam_beta1 \
+      --adam_beta2 $adam_beta2 \
+      --B_variance_reduction $B_variance_reduction \
+      --svrg_refresh_epochs $svrg_refresh_epochs \
+      --svrg_anchor_fraction $svrg_anchor_fraction \
       --table_staleness $table_staleness \
       --maximum_running_time $maximum_running_time
       --$flag_load_cache
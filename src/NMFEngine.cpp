@@ -6,11 +6,14 @@
 #include <fstream>
 #include <cmath>
 #include <mutex>
+#include <random>
+#include <numeric>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <petuum_ps_common/include/petuum_ps.hpp>
 
 #include "util/Eigen/Dense"
 #include "util/context.hpp"
+#include "matrix_format.hpp"
 
 namespace NMF {
 
@@ -34,6 +37,7 @@ namespace NMF {
         // objective function parameters
         int m = context.get_int32("m");
         int n = context.get_int32("n");
+        n_ = n;
         dictionary_size_ = context.get_int32("dictionary_size");
 
         // petuum parameters
@@ -54,23 +58,227 @@ namespace NMF {
         init_step_size_S_ = context.get_double("init_step_size_S");
         step_size_offset_S_ = context.get_double("step_size_offset_S");
         step_size_pow_S_ = context.get_double("step_size_pow_S");
+        S_optimizer_ = context.get_string("S_optimizer");
+        num_power_iter_ = context.get_int32("num_power_iter");
+        S_convergence_tol_ = context.get_double("S_convergence_tol");
+        converged_col_sample_prob_ = 
+            context.get_double("converged_col_sample_prob");
+        sampling_mode_ = context.get_string("sampling_mode");
+        importance_sampling_uniform_mix_ = 
+            context.get_double("importance_sampling_uniform_mix");
+        CHECK(sampling_mode_ == "uniform" || sampling_mode_ == "residual")
+            << "Unrecognized sampling mode: " << sampling_mode_;
+        CHECK(S_optimizer_ == "pgd" || S_optimizer_ == "fista" 
+                || S_optimizer_ == "mu")
+            << "Unrecognized S optimizer: " << S_optimizer_;
+        B_optimizer_ = context.get_string("B_optimizer");
+        B_optimizer_granularity_ = 
+            context.get_string("B_optimizer_granularity");
+        adaptive_epsilon_ = context.get_double("adaptive_epsilon");
+        adam_beta1_ = context.get_double("adam_beta1");
+        adam_beta2_ = context.get_double("adam_beta2");
+        CHECK(B_optimizer_ == "sgd" || B_optimizer_ == "adagrad" 
+                || B_optimizer_ == "adam")
+            << "Unrecognized B optimizer: " << B_optimizer_;
+        B_variance_reduction_ = context.get_string("B_variance_reduction");
+        svrg_refresh_epochs_ = context.get_int32("svrg_refresh_epochs");
+        svrg_anchor_fraction_ = context.get_double("svrg_anchor_fraction");
+        CHECK(B_variance_reduction_ == "none" || B_variance_reduction_ == "svrg")
+            << "Unrecognized variance reduction: " << B_variance_reduction_;
+        CHECK(B_variance_reduction_ == "none" || (svrg_refresh_epochs_ > 0 && 
+                    svrg_anchor_fraction_ > 0.0 && svrg_anchor_fraction_ <= 1.0))
+            << "svrg_refresh_epochs must be positive and svrg_anchor_fraction "
+            "must be within (0, 1]";
+        early_stop_tol_ = context.get_double("early_stop_tol");
+        early_stop_window_ = context.get_int32("early_stop_window");
+        early_stop_smoothing_ = context.get_double("early_stop_smoothing");
+        CHECK(early_stop_tol_ <= 0.0 || (early_stop_window_ > 0 && 
+                    early_stop_smoothing_ >= 0.0 && early_stop_smoothing_ < 1.0))
+            << "early_stop_window must be positive and early_stop_smoothing "
+            "must be within [0, 1)";
+        init_method_ = context.get_string("init_method");
+        init_sample_fraction_ = context.get_double("init_sample_fraction");
+        nndsvd_rank_ = context.get_int32("nndsvd_rank");
+        int random_seed = context.get_int32("random_seed");
+        random_seed_ = (random_seed < 0)? (unsigned)time(NULL): random_seed;
+        CHECK(init_method_ == "random" || init_method_ == "nndsvd" 
+                || init_method_ == "random_columns" 
+                || init_method_ == "kmeanspp")
+            << "Unrecognized init method: " << init_method_;
+        CHECK(init_sample_fraction_ > 0.0 && init_sample_fraction_ <= 1.0)
+            << "init_sample_fraction must be within (0, 1]";
+        B_subset_fetch_ = context.get_bool("B_subset_fetch");
+        B_full_fetch_interval_ = context.get_int32("B_full_fetch_interval");
+        CHECK(!B_subset_fetch_ || B_full_fetch_interval_ > 0)
+            << "B_full_fetch_interval must be positive";
+        CHECK(!B_subset_fetch_ || B_variance_reduction_ == "none")
+            << "B_subset_fetch does not support svrg, whose anchor gradient "
+            "updates all atoms";
+        auto_step_size_ = context.get_bool("auto_step_size");
+        auto_step_size_interval_ = context.get_int32("auto_step_size_interval");
+        CHECK(!auto_step_size_ || auto_step_size_interval_ > 0)
+            << "auto_step_size_interval must be positive";
+        CHECK(B_optimizer_granularity_ == "entry" 
+                || B_optimizer_granularity_ == "row")
+            << "Unrecognized B optimizer granularity: " 
+            << B_optimizer_granularity_;
 
         /* Init matrices */
         // Partition by column id mod num_clients_
         int client_n = (n - (n / num_clients_) * num_clients_ > client_id_)?
             n / num_clients_ + 1: n / num_clients_;
         // Init matrix loader of data matrix X
-        if (is_partitioned_) {
-            X_matrix_loader_.Init(data_file_, input_data_format_, m, client_n);
+        sparse_X_ = (input_data_format_ == "libsvm" 
+                || input_data_format_ == "mtx");
+        float X_memory_budget = context.get_double("X_memory_budget");
+        if (X_memory_budget > 0.0) {
+            CHECK(!sparse_X_) << "X_memory_budget requires dense input";
+            CHECK(sampling_mode_ == "uniform" 
+                    && converged_col_sample_prob_ >= 1.0)
+                << "X_memory_budget samples columns among resident blocks, "
+                "which does not support sampling priorities";
+            std::string X_cache_path = context.get_string("X_cache_path");
+            if (X_cache_path.empty())
+                X_cache_path = output_path_;
+            X_matrix_loader_.SetOutOfCore(X_cache_path + "/X.cache." 
+                    + std::to_string(client_id_), 
+                    long(X_memory_budget * 1024 * 1024), 
+                    context.get_int32("X_block_size"));
+        }
+        std::string X_precision = context.get_string("X_precision");
+        if (X_precision != "fp32") {
+            CHECK(!sparse_X_) << "X_precision requires dense input";
+            CHECK(X_memory_budget <= 0.0) 
+                << "X_memory_budget keeps X in fp32";
+            X_matrix_loader_.SetPrecision(X_precision);
+        }
+        if (is_partitioned_ && sparse_X_) {
+            X_matrix_loader_.InitSparse(data_file_, input_data_format_, m, 
+                    client_n, 0, 1, num_worker_threads_);
+        } else if (is_partitioned_) {
+            X_matrix_loader_.Init(data_file_, input_data_format_, m, client_n,
+                    num_worker_threads_);
+        } else if (sparse_X_) {
+            // Columns are balanced by number of nonzeros instead
+            X_matrix_loader_.InitSparse(data_file_, input_data_format_, m, n,
+                    client_id_, num_clients_, num_worker_threads_);
+            client_n = X_matrix_loader_.GetClientN();
         } else {
             X_matrix_loader_.Init(data_file_, input_data_format_, m, n, 
-                    client_id_, num_clients_);
+                    client_id_, num_clients_, num_worker_threads_);
         }
+        // The loss is evaluated against X as stored
+        if (X_precision != "fp32") {
+            LOG(INFO) << "client " << client_id_ << " keeps X in " 
+                << X_precision << ", average squared error per column: " 
+                << X_matrix_loader_.GetQuantizationError();
+        }
+        objective_ = context.get_string("objective");
+        CHECK(objective_ == "frobenius" || objective_ == "masked" 
+                || objective_ == "kl")
+            << "Unrecognized objective: " << objective_;
+        CHECK(objective_ != "masked" || sparse_X_)
+            << "masked objective requires input_data_format libsvm or mtx";
+        CHECK(objective_ != "masked" || B_variance_reduction_ == "none")
+            << "masked objective does not support svrg, whose anchor gradient"
+            " is computed over all entries";
+        CHECK(objective_ != "kl" || (S_optimizer_ != "fista" 
+                    && !auto_step_size_ && B_variance_reduction_ == "none"))
+            << "kl objective does not support fista, auto_step_size or svrg, "
+            "which rely on the squared error";
+        CHECK(S_optimizer_ != "mu" || objective_ == "kl")
+            << "S optimizer mu requires the kl objective";
 
         // Init matrix loader of coefficients S
         if (dictionary_size_ == 0)
             dictionary_size_ = n; 
-        S_matrix_loader_.Init(dictionary_size_, client_n, -0.0, 0.01);
+        // B and S are allocated for all atoms the dictionary may grow to
+        init_dictionary_size_ = dictionary_size_;
+        dictionary_size_ = std::max(dictionary_size_, 
+                context.get_int32("max_dictionary_size"));
+        dictionary_growth_size_ = context.get_int32("dictionary_growth_size");
+        if (dictionary_growth_size_ <= 0)
+            dictionary_growth_size_ = (init_dictionary_size_ + 9) / 10;
+        atom_prune_tol_ = context.get_double("atom_prune_tol");
+        sparse_product_density_ = context.get_double("sparse_product_density");
+        if (sparse_product_density_ < 0.0) {
+            sparse_product_density_ = 
+                CalibrateSparseProduct(m, dictionary_size_);
+            LOG(INFO) << "columns of S with at most " << sparse_product_density_
+                << " of nonzeros are multiplied sparsely";
+        }
+        CHECK(dictionary_size_ == init_dictionary_size_ 
+                || early_stop_tol_ > 0.0)
+            << "max_dictionary_size requires early_stop_tol greater than 0 to "
+            "detect plateaus of the loss";
+        // Columns of S are seeded by their global column ids, where column j
+        // of partitioned data is taken as global column client_id_ + j * 
+        // num_clients_ 
+        std::vector<int> global_cols = X_matrix_loader_.GetGlobalCols();
+        if (is_partitioned_) {
+            global_cols.resize(client_n);
+            for (int j = 0; j < client_n; ++j) {
+                global_cols[j] = client_id_ + j * num_clients_;
+            }
+        }
+        sparse_S_density_ = context.get_double("sparse_S_density");
+        std::string S_map_file = context.get_string("S_map_file");
+        if (S_map_file.empty()) {
+            S_matrix_loader_.Init(dictionary_size_, client_n, -0.0, 0.01, 
+                    random_seed_, global_cols, num_worker_threads_);
+        } else {
+            // S is updated in place in its file, which load_cache maps again
+            S_matrix_loader_.InitMapped(S_map_file + "." 
+                    + std::to_string(client_id_), load_cache_, 
+                    dictionary_size_, client_n, -0.0, 0.01, random_seed_, 
+                    global_cols, num_worker_threads_);
+            if (sparse_S_density_ > 0.0)
+                LOG(INFO) << "mapped S is stored densely";
+            sparse_S_density_ = 0.0;
+        }
+        S_matrix_loader_.SetSparseDensity(sparse_S_density_);
+        if (S_convergence_tol_ > 0.0) {
+            S_matrix_loader_.SetSamplingPriority(S_convergence_tol_, 
+                    converged_col_sample_prob_);
+        }
+        // Residuals start from norms of data columns as B is close to 0
+        if (sampling_mode_ == "residual") {
+            std::vector<float> residuals(client_n), X_col(m);
+            for (int j = 0; j < client_n; ++j) {
+                X_matrix_loader_.GetCol(j, X_col);
+                double squared_norm = 0.0;
+                for (int i = 0; i < m; ++i) {
+                    squared_norm += X_col[i] * X_col[i];
+                }
+                residuals[j] = sqrt(squared_norm);
+            }
+            S_matrix_loader_.EnableImportanceSampling(residuals, 
+                    importance_sampling_uniform_mix_);
+        }
+
+        // Extra state of the adaptive optimizers of B, which is held by the 
+        // process cache of every client as well as by the servers
+        if (B_optimizer_ != "sgd") {
+            double state_size = (B_optimizer_granularity_ == "entry")?
+                double(dictionary_size_) * m: dictionary_size_;
+            if (B_optimizer_ == "adam")
+                state_size += double(dictionary_size_) * (m + 1);
+            LOG(INFO) << "Optimizer " << B_optimizer_ << " of B keeps " 
+                << state_size * sizeof(float) / 1024 / 1024 
+                << " MB of extra state per client";
+        }
+
+        // Anchor of svrg, whose size is logged as above
+        if (B_variance_reduction_ == "svrg") {
+            svrg_anchor_B_.setZero(m, dictionary_size_);
+            svrg_anchor_grad_.setZero(m, dictionary_size_);
+            LOG(INFO) << "svrg keeps " << 3.0 * m * dictionary_size_ 
+                * sizeof(float) / 1024 / 1024 << " MB of anchor dictionary, "
+                "anchor gradient and anchor gradient table per client, and "
+                << double(m) * dictionary_size_ * num_worker_threads_
+                * sizeof(float) / 1024 / 1024 << " MB at most of partial anchor "
+                "gradients while refreshing";
+        }
 
 	    int max_client_n = ceil(float(n) / num_clients_);
 	    int iter_minibatch = 
@@ -89,6 +297,196 @@ namespace NMF {
         }
     }
 
+    // Helper function clamping a column of S to [0, MAXELEVAL] and zeroing
+    // entries below INFINITESIMAL, as MatrixLoader::IncCol does with low 0
+    inline void ClampS(Eigen::VectorXf & s) {
+        s = (s.array() < INFINITESIMAL).select(0.0f, 
+                s.array().min(float(MAXELEVAL))).matrix();
+    }
+
+    // Helper function copying num_rows consecutive rows of table starting at 
+    // row_offset to the columns of cache, where cache.rows() leading 
+    // elements of each row are copied
+    inline void FetchRows(petuum::Table<float> & table, int row_offset, 
+            Eigen::MatrixXf & cache) {
+        std::vector<float> petuum_row_cache;
+        petuum::RowAccessor row_acc;
+        for (int col_id = 0; col_id < cache.cols(); ++col_id) {
+            table.Get(row_offset + col_id, &row_acc);
+            const petuum::DenseRow<float> & petuum_row = 
+                row_acc.Get<petuum::DenseRow<float> >();
+            petuum_row.CopyToVector(&petuum_row_cache);
+            for (int row_id = 0; row_id < cache.rows(); ++row_id) {
+                cache(row_id, col_id) = petuum_row_cache[row_id];
+            }
+        }
+    }
+
+    // Helper function adding the columns of inc times scale to consecutive 
+    // rows of table starting at row_offset
+    inline void IncRows(petuum::Table<float> & table, int row_offset, 
+            const Eigen::MatrixXf & inc, float scale = 1.0) {
+        for (int col_id = 0; col_id < inc.cols(); ++col_id) {
+            petuum::UpdateBatch<float> update;
+            for (int row_id = 0; row_id < inc.rows(); ++row_id) {
+                update.Update(row_id, scale * inc(row_id, col_id));
+            }
+            table.BatchInc(row_offset + col_id, update);
+        }
+    }
+
+    // Helper function setting row row_id of table to 0
+    inline void ClearRow(petuum::Table<float> & table, int row_id) {
+        std::vector<float> petuum_row_cache;
+        petuum::RowAccessor row_acc;
+        table.Get(row_id, &row_acc);
+        row_acc.Get<petuum::DenseRow<float> >().CopyToVector(
+                &petuum_row_cache);
+        petuum::UpdateBatch<float> update;
+        for (int col_id = 0; col_id < (int)petuum_row_cache.size(); ++col_id) {
+            update.Update(col_id, -petuum_row_cache[col_id]);
+        }
+        table.BatchInc(row_id, update);
+    }
+
+    // Helper function gathering the entries atoms of full into part
+    inline void GatherAtoms(const Eigen::VectorXf & full, 
+            const std::vector<int> & atoms, Eigen::VectorXf & part) {
+        part.resize(atoms.size());
+        for (int i = 0; i < (int)atoms.size(); ++i) {
+            part(i) = full(atoms[i]);
+        }
+    }
+
+    // Helper function computing Bs = B * s. If at most a fraction 
+    // max_density of s is nonzero, only the columns of B at the nonzeros 
+    // are gathered, which costs O(m nnz(s)) instead of O(m k)
+    inline void SparseProduct(const Eigen::MatrixXf & B, 
+            const Eigen::VectorXf & s, float max_density, 
+            Eigen::VectorXf & Bs) {
+        int k = s.size();
+        int max_nnz = int(max_density * k), nnz = 0;
+        for (int i = 0; i < k && nnz <= max_nnz; ++i) {
+            if (s(i) != 0.0)
+                ++nnz;
+        }
+        if (nnz > max_nnz) {
+            Bs.noalias() = B * s;
+            return;
+        }
+        Bs.setZero(B.rows());
+        for (int i = 0; i < k; ++i) {
+            if (s(i) != 0.0)
+                Bs.noalias() += s(i) * B.col(i);
+        }
+    }
+
+    // Helper function computing Btx = B^T x from Bt = B^T and the nonzeros 
+    // idx and val of x, which costs O(k nnz(x))
+    inline void SparseTransposeProduct(const Eigen::MatrixXf & Bt, 
+            const std::vector<int> & idx, const std::vector<float> & val, 
+            Eigen::VectorXf & Btx) {
+        Btx.setZero(Bt.rows());
+        for (int p = 0; p < (int)idx.size(); ++p) {
+            Btx.noalias() += val[p] * Bt.col(idx[p]);
+        }
+    }
+
+    // Helper function computing the residual r = x - Bs from the nonzeros 
+    // idx and val of x
+    inline void SparseResidual(const std::vector<int> & idx, 
+            const std::vector<float> & val, const Eigen::VectorXf & Bs, 
+            Eigen::VectorXf & r) {
+        r = -Bs;
+        for (int p = 0; p < (int)idx.size(); ++p) {
+            r(idx[p]) += val[p];
+        }
+    }
+
+    // Helper function gathering the rows idx of B into part, given Bt = B^T
+    inline void GatherRows(const Eigen::MatrixXf & Bt, 
+            const std::vector<int> & idx, Eigen::MatrixXf & part) {
+        part.resize(idx.size(), Bt.rows());
+        for (int p = 0; p < (int)idx.size(); ++p) {
+            part.row(p) = Bt.col(idx[p]).transpose();
+        }
+    }
+
+    // Helper function adding r * s^T to the rows idx of A, touching only the
+    // columns of A at the nonzeros of s
+    inline void MaskedRankOneUpdate(Eigen::MatrixXf & A, 
+            const std::vector<int> & idx, const Eigen::VectorXf & r, 
+            const Eigen::VectorXf & s) {
+        for (int i = 0; i < s.size(); ++i) {
+            if (s(i) == 0.0)
+                continue;
+            float * col = A.col(i).data();
+            for (int p = 0; p < (int)idx.size(); ++p) {
+                col[idx[p]] += r(p) * s(i);
+            }
+        }
+    }
+
+    // Helper function computing the generalized KL divergence of Bs from x,
+    // sum of x log(x / Bs) - x + Bs, given the nonzeros x_obs of x, Bs_obs,
+    // the entries of Bs at them, and Bs_sum, the sum of Bs
+    inline double KLDivergence(const Eigen::VectorXf & x_obs, 
+            const Eigen::VectorXf & Bs_obs, double Bs_sum) {
+        double divergence = Bs_sum;
+        for (int p = 0; p < x_obs.size(); ++p) {
+            if (x_obs(p) > 0.0) {
+                divergence += x_obs(p) * (log(x_obs(p)) - 
+                        log(std::max(Bs_obs(p), float(INFINITESIMAL)))) 
+                    - x_obs(p);
+            }
+        }
+        return divergence;
+    }
+
+    // Helper function adding r * s^T to A, touching only the columns of A at
+    // the nonzeros of s if at most a fraction max_density of s is nonzero
+    inline void SparseRankOneUpdate(Eigen::MatrixXf & A, 
+            const Eigen::VectorXf & r, const Eigen::VectorXf & s, 
+            float max_density) {
+        int k = s.size();
+        int max_nnz = int(max_density * k), nnz = 0;
+        for (int i = 0; i < k && nnz <= max_nnz; ++i) {
+            if (s(i) != 0.0)
+                ++nnz;
+        }
+        if (nnz > max_nnz) {
+            A.noalias() += r * s.transpose();
+            return;
+        }
+        for (int i = 0; i < k; ++i) {
+            if (s(i) != 0.0)
+                A.col(i).noalias() += s(i) * r;
+        }
+    }
+
+    // Helper function estimating the largest eigenvalue of A^T A by power 
+    // iteration. v is the starting vector and holds the estimated leading 
+    // right singular vector of A on return, so that it can warm start the 
+    // next estimation after A changes slightly
+    inline float EstimateSquaredNorm(const Eigen::MatrixXf & A, 
+            Eigen::VectorXf & v, int num_iter) {
+        float lambda = 0.0;
+        if (v.norm() < INFINITESIMAL)
+            v.setOnes();
+        v.normalize();
+        for (int iter = 0; iter < num_iter; ++iter) {
+            Eigen::VectorXf Av = A * v;
+            v.noalias() = A.transpose() * Av;
+            lambda = v.norm();
+            if (lambda < INFINITESIMAL) {
+                v.setOnes();
+                return 0.0;
+            }
+            v /= lambda;
+        }
+        return lambda;
+    }
+
     // Save results: dicitonary B, coefficients S, loss evaluated on different
     // machines, time between evaluations to disk.
     // Shall be called after calling petuum::PSTableGroup::GlobalBarrier()
@@ -101,8 +499,10 @@ namespace NMF {
         // Caches
         std::vector<float> B_row_cache(m), S_cache(dictionary_size_);
 
-        // Output files
+        // Output files, and writers of files in format "nmf" and "npy"
         std::ofstream fout_loss, fout_B, fout_S, fout_time;
+        MatrixFileWriter B_writer, S_writer;
+        NpyFileWriter B_npy_writer, S_npy_writer;
 
         // Only thread 0 of client 0 write dictionary B, loss and time to disk
         if (client_id_ == 0 && thread_id == 0) {
@@ -149,13 +549,19 @@ namespace NMF {
             }
 	        fout_time.close();
             // Write dictionary B to disk
-            // with filename output_path_/B.[txt|bin]
+            // with filename output_path_/B.[txt|bin|nmf|npy], where B.nmf 
+            // and B.npy hold the m-by-dictionary_size matrix
             if (output_data_format_ == "text") {
                 std::string B_filename = output_path_ + "/B.txt";
                 fout_B.open(B_filename.c_str());
             } else if (output_data_format_ == "binary") {
                 std::string B_filename = output_path_ + "/B.bin";
                 fout_B.open(B_filename.c_str(), std::ios::binary);
+            } else if (output_data_format_ == "nmf") {
+                B_writer.Open(output_path_ + "/B.nmf", m, dictionary_size_);
+            } else if (output_data_format_ == "npy") {
+                B_npy_writer.Open(output_path_ + "/B.npy", m, 
+                        dictionary_size_);
             } else {
                 LOG(FATAL) << "Unrecognized data format: " << output_data_format_;
             }
@@ -166,6 +572,10 @@ namespace NMF {
                 petuum_row.CopyToVector(&petuum_row_cache);
                 // Non-negativise_
                 RegVec(petuum_row_cache, B_row_cache);
+                if (output_data_format_ == "nmf")
+                    B_writer.AppendCol(B_row_cache.data());
+                else if (output_data_format_ == "npy")
+                    B_npy_writer.AppendCol(B_row_cache.data());
                 for (int col_id = 0; col_id < m; ++col_id) {
                     if (output_data_format_ == "text") {
                         fout_B << B_row_cache[col_id] << "\t";
@@ -178,11 +588,21 @@ namespace NMF {
                     fout_B << "\n";
                 }
             }
-            fout_B.close();
+            if (output_data_format_ == "nmf") {
+                B_writer.Close();
+            } else if (output_data_format_ == "npy") {
+                B_npy_writer.Close();
+            } else {
+                fout_B.close();
+            }
         }
         // Thread 0 of each client save that client's part of S 
-        // to output_path_/S.[txt|bin].client_id_
-        if (thread_id == 0) {
+        // to output_path_/S.[txt|bin|nmf|npy].client_id_, or flushes it to 
+        // its file
+        // if S is mapped
+        if (thread_id == 0 && S_matrix_loader_.IsMapped()) {
+            S_matrix_loader_.Sync();
+        } else if (thread_id == 0) {
             if (output_data_format_ == "text") {
                 std::string S_filename = output_path_ + "/S.txt." 
                     + std::to_string(client_id_);
@@ -191,12 +611,24 @@ namespace NMF {
                 std::string S_filename = output_path_ + "/S.bin." 
                     + std::to_string(client_id_);
                 fout_S.open(S_filename.c_str(), std::ios::binary);
+            } else if (output_data_format_ == "nmf") {
+                S_writer.Open(output_path_ + "/S.nmf." 
+                        + std::to_string(client_id_), dictionary_size_, 
+                        client_n);
+            } else if (output_data_format_ == "npy") {
+                S_npy_writer.Open(output_path_ + "/S.npy." 
+                        + std::to_string(client_id_), dictionary_size_, 
+                        client_n);
             } else {
                 LOG(FATAL) << "Unrecognized data format: " << output_data_format_;
             }
             for (int col_id_client = 0; col_id_client < client_n; 
                     ++col_id_client) {
                 if (S_matrix_loader_.GetCol(col_id_client, S_cache)) {
+                    if (output_data_format_ == "nmf")
+                        S_writer.AppendCol(S_cache.data());
+                    else if (output_data_format_ == "npy")
+                        S_npy_writer.AppendCol(S_cache.data());
                     for (int row_id = 0; row_id < dictionary_size_; ++row_id) {
                         if (output_data_format_ == "text") {
                             fout_S << S_cache[row_id] << "\t";
@@ -210,7 +642,28 @@ namespace NMF {
                         }
                 }
             }
-            fout_S.close();
+            if (output_data_format_ == "nmf") {
+                S_writer.Close();
+            } else if (output_data_format_ == "npy") {
+                S_npy_writer.Close();
+            } else {
+                fout_S.close();
+            }
+        }
+        // Columns of sparse data, of files in format "nmf" or "npy" and of
+        // directories of shards are not partitioned by column id, write the
+        // global column id of each column of S to 
+        // output_path_/S.cols.client_id_
+        bool assigned_cols = sparse_X_ || input_data_format_ == "nmf" 
+            || input_data_format_ == "npy" || IsShardDirectory(data_file_);
+        if (thread_id == 0 && assigned_cols && !is_partitioned_) {
+            std::string cols_filename = output_path_ + "/S.cols." 
+                + std::to_string(client_id_);
+            std::ofstream fout_cols(cols_filename.c_str());
+            for (int col: X_matrix_loader_.GetGlobalCols()) {
+                fout_cols << col << "\n";
+            }
+            fout_cols.close();
         }
     }
 
@@ -219,32 +672,64 @@ namespace NMF {
         // size of matrices
         int m = X_matrix_loader_.GetM();
         int client_n = X_matrix_loader_.GetClientN();
+        // Cache files of sparse data are in the dense output format
+        std::string cache_format = sparse_X_? output_data_format_: 
+            input_data_format_;
         if (client_id_ == 0 && thread_id == 0) {
 	        // Load B
 	        std::ifstream fout_B;
-            std::vector<float> B_row_cache(m);
+            MatrixFileReader B_reader;
+            NpyFileReader B_npy_reader;
+            std::vector<float> B_row_cache(m), B_chunk;
 
             std::string B_filename;
-            if (input_data_format_ == "text") {
+            if (cache_format == "text") {
 	            B_filename = cache_path_ + "/B.txt";
                 fout_B.open(B_filename.c_str());
-            } else if (input_data_format_ == "binary") {
+            } else if (cache_format == "binary") {
 	            B_filename = cache_path_ + "/B.bin";
                 fout_B.open(B_filename.c_str(), std::ios::binary);
+            } else if (cache_format == "nmf") {
+	            B_filename = cache_path_ + "/B.nmf";
+                B_reader.Open(B_filename);
+                CHECK(B_reader.GetRows() == m 
+                        && B_reader.GetCols() == dictionary_size_)
+                    << "Cache file " << B_filename << " does not hold a " 
+                    << m << "-by-" << dictionary_size_ << " dictionary";
+            } else if (cache_format == "npy") {
+	            B_filename = cache_path_ + "/B.npy";
+                B_npy_reader.Open(B_filename);
+                CHECK(B_npy_reader.GetRows() == m 
+                        && B_npy_reader.GetCols() == dictionary_size_)
+                    << "Cache file " << B_filename << " does not hold a " 
+                    << m << "-by-" << dictionary_size_ << " dictionary";
             } else {
-                LOG(FATAL) << "Unrecognized data format: " << output_data_format_;
+                LOG(FATAL) << "Unrecognized data format: " << cache_format;
             }
 
             CHECK(fout_B.good()) 
                 << "Cache file " << B_filename << " does not exist!";
             for (int row_id = 0; row_id < dictionary_size_; ++row_id) {
                 petuum::UpdateBatch<float> B_update;
+                // Atoms are columns of B.nmf, read a chunk at a time
+                long chunk_offset = 0;
+                if (cache_format == "nmf") {
+                    long chunk_cols = B_reader.GetChunkCols();
+                    if (row_id % chunk_cols == 0)
+                        B_reader.ReadChunk(row_id / chunk_cols, B_chunk);
+                    chunk_offset = (row_id % chunk_cols) * m;
+                } else if (cache_format == "npy") {
+                    B_npy_reader.ReadCols(row_id, row_id + 1, 
+                            B_row_cache.data());
+                }
                 for (int col_id = 0; col_id < m; ++col_id) {
-                    if (input_data_format_ == "text") {
+                    if (cache_format == "text") {
                         fout_B >> B_row_cache[col_id];
-                    } else if (input_data_format_ == "binary") {
+                    } else if (cache_format == "binary") {
                         fout_B.read(reinterpret_cast<char*> (
                                 &(B_row_cache[col_id])), 4);
+                    } else if (cache_format == "nmf") {
+                        B_row_cache[col_id] = B_chunk[chunk_offset + col_id];
                     }
 			        B_update.Update(col_id, B_row_cache[col_id]);
                 }
@@ -252,23 +737,42 @@ namespace NMF {
             }
             fout_B.close();
         }
-		// Load S
-       	if (thread_id == 0) {
+		// Load S, unless the mapped S has been kept
+       	if (thread_id == 0 && !S_matrix_loader_.IsMapped()) {
 		    std::ifstream fout_S;
+            MatrixFileReader S_reader;
+            NpyFileReader S_npy_reader;
             std::vector<float> S_cache(dictionary_size_), 
-                S_inc_cache(dictionary_size_);
+                S_inc_cache(dictionary_size_), S_chunk;
 
             std::string S_filename;
-            if (input_data_format_ == "text") {
+            if (cache_format == "text") {
                 S_filename = cache_path_ + "/S.txt." +
                     std::to_string(client_id_);
        	        fout_S.open(S_filename.c_str());
-            } else if (input_data_format_ == "binary") {
+            } else if (cache_format == "binary") {
                 S_filename = cache_path_ + "/S.bin." +
                     std::to_string(client_id_);
        	        fout_S.open(S_filename.c_str(), std::ios::binary);
+            } else if (cache_format == "nmf") {
+                S_filename = cache_path_ + "/S.nmf." +
+                    std::to_string(client_id_);
+                S_reader.Open(S_filename);
+                CHECK(S_reader.GetRows() == dictionary_size_ 
+                        && S_reader.GetCols() == client_n)
+                    << "Cache file " << S_filename << " does not hold a " 
+                    << dictionary_size_ << "-by-" << client_n << " matrix";
+            } else if (cache_format == "npy") {
+                S_filename = cache_path_ + "/S.npy." +
+                    std::to_string(client_id_);
+                S_npy_reader.Open(S_filename);
+                S_chunk.resize(dictionary_size_);
+                CHECK(S_npy_reader.GetRows() == dictionary_size_ 
+                        && S_npy_reader.GetCols() == client_n)
+                    << "Cache file " << S_filename << " does not hold a " 
+                    << dictionary_size_ << "-by-" << client_n << " matrix";
             } else {
-                LOG(FATAL) << "Unrecognized data format: " << output_data_format_;
+                LOG(FATAL) << "Unrecognized data format: " << cache_format;
             }
 
             CHECK(fout_S.good()) 
@@ -276,13 +780,30 @@ namespace NMF {
        	    for (int col_id_client = 0; col_id_client < client_n; 
                     ++col_id_client) {
        	        if (S_matrix_loader_.GetCol(col_id_client, S_cache)) {
+                    long chunk_offset = 0;
+                    if (cache_format == "nmf") {
+                        long chunk_cols = S_reader.GetChunkCols();
+                        if (col_id_client % chunk_cols == 0) {
+                            S_reader.ReadChunk(col_id_client / chunk_cols, 
+                                    S_chunk);
+                        }
+                        chunk_offset = 
+                            (col_id_client % chunk_cols) * dictionary_size_;
+                    } else if (cache_format == "npy") {
+                        S_npy_reader.ReadCols(col_id_client, 
+                                col_id_client + 1, S_chunk.data());
+                    }
        	            for (int row_id = 0; row_id < dictionary_size_; 
                             ++row_id) {
-                        if (input_data_format_ == "text") {
+                        if (cache_format == "text") {
        	                    fout_S >> S_inc_cache[row_id];
-                        } else if (input_data_format_ == "binary") {
+                        } else if (cache_format == "binary") {
                             fout_S.read(reinterpret_cast<char*> (
                                 &(S_inc_cache[row_id])), 4);
+                        } else if (cache_format == "nmf" 
+                                || cache_format == "npy") {
+                            S_inc_cache[row_id] = 
+                                S_chunk[chunk_offset + row_id];
                         }
 			            S_inc_cache[row_id] = 
                             S_inc_cache[row_id] - S_cache[row_id];
@@ -295,26 +816,261 @@ namespace NMF {
         }
     }
 
-    // Init B table with 0~1 random data
+    // Init owned rows of B table with 0~0.01 random data, each row drawn 
+    // from its own stream so that the result does not depend on the number 
+    // of clients and threads
     void NMFEngine::InitRand(int thread_id, petuum::Table<float> & B_table) {
-        if (thread_id != 0)
-            return;
         // size of matrices
         int m = X_matrix_loader_.GetM();
-        srand((unsigned)time(NULL));
-        std::vector<float> B_row_cache(m);
-        // petuum row accessor
-        petuum::RowAccessor row_acc;
-        for (int row_id = 0; row_id < dictionary_size_; ++row_id) {
+        std::uniform_real_distribution<float> uniform(0.0, 0.01);
+        std::vector<int> atoms = OwnedAtoms(thread_id);
+        for (int row_id: atoms) {
+            std::seed_seq seq{random_seed_, 0u, (unsigned)row_id};
+            std::mt19937 rng(seq);
             petuum::UpdateBatch<float> B_update;
-            B_table.Get(row_id, &row_acc);
             for (int col_id = 0; col_id < m; ++col_id) {
-                B_row_cache[col_id] = double(rand()) / RAND_MAX * 0.01;
+                B_update.Update(col_id, uniform(rng));
+            }
+            B_table.BatchInc(row_id, B_update);
+        }
+    }
+
+    // Rows of B are dealt to worker threads of all clients in turn
+    std::vector<int> NMFEngine::OwnedAtoms(int thread_id) {
+        std::vector<int> atoms;
+        int num_threads = num_clients_ * num_worker_threads_;
+        for (int row_id = client_id_ * num_worker_threads_ + thread_id; 
+                row_id < init_dictionary_size_; row_id += num_threads) {
+            atoms.push_back(row_id);
+        }
+        return atoms;
+    }
+
+    // Init B from sampled columns of X
+    void NMFEngine::InitFromData(int thread_id, petuum::Table<float> & B_table,
+            petuum::Table<float> & init_table, std::vector<int> & init_cols) {
+        int m = X_matrix_loader_.GetM();
+        int client_n = X_matrix_loader_.GetClientN();
+        std::seed_seq seq{random_seed_, 1u, 
+            (unsigned)(client_id_ * num_worker_threads_ + thread_id)};
+        std::mt19937 rng(seq);
+        std::uniform_real_distribution<float> uniform(0.0, 1.0);
+        // Sample from columns j = thread_id mod num_worker_threads_
+        std::vector<int> sample_cols;
+        for (int j = thread_id; j < client_n; j += num_worker_threads_) {
+            if (uniform(rng) < init_sample_fraction_)
+                sample_cols.push_back(j);
+        }
+        int p = sample_cols.size();
+        Eigen::MatrixXf Xs(m, p);
+        Eigen::VectorXf Xj(m);
+        for (int i = 0; i < p; ++i) {
+            X_matrix_loader_.GetCol(sample_cols[i], Xj);
+            Xs.col(i) = Xj;
+        }
+
+        std::vector<int> atoms = OwnedAtoms(thread_id);
+        int num_atoms = atoms.size();
+        Eigen::MatrixXf W = Eigen::MatrixXf::Zero(m, num_atoms);
+        int num_filled = 0;
+        if (init_method_ == "nndsvd") {
+            num_filled = InitNNDSVD(thread_id, Xs, sample_cols, atoms, W, 
+                    init_table, rng);
+            init_cols = sample_cols;
+        }
+        // Remaining atoms are sampled columns, chosen uniformly or by 
+        // k-means++ seeding, which chooses a column with probability 
+        // proportional to its squared distance to the closest chosen column
+        Eigen::VectorXf dist;
+        for (int a = num_filled; a < num_atoms; ++a) {
+            if (p == 0) {
+                // no column to sample from, fall back to random values
+                for (int i = 0; i < m; ++i) {
+                    W(i, a) = uniform(rng) * 0.01;
+                }
+                continue;
+            }
+            int pick = rng() % p;
+            if (init_method_ == "kmeanspp" && a > num_filled) {
+                float target = uniform(rng) * dist.sum();
+                for (pick = 0; pick < p - 1; ++pick) {
+                    target -= dist(pick);
+                    if (target < 0.0)
+                        break;
+                }
             }
+            // Atoms are scaled to unit norm so that the default step sizes 
+            // stay stable; the warm start of S absorbs the scale
+            float pick_norm = Xs.col(pick).norm();
+            if (pick_norm > 0.0)
+                W.col(a) = Xs.col(pick) / pick_norm;
+            if (init_method_ == "kmeanspp") {
+                Eigen::VectorXf pick_dist = 
+                    (Xs.colwise() - Xs.col(pick)).colwise().squaredNorm();
+                dist = (a == num_filled)? pick_dist: dist.cwiseMin(pick_dist);
+            }
+        }
+        for (int a = 0; a < num_atoms; ++a) {
+            petuum::UpdateBatch<float> B_update;
             for (int col_id = 0; col_id < m; ++col_id) {
-                B_update.Update(col_id, B_row_cache[col_id]);
+                B_update.Update(col_id, W(col_id, a));
+            }
+            B_table.BatchInc(atoms[a], B_update);
+        }
+    }
+
+    // Distributed nndsvd (Boutsidis and Gallopoulos, 2008) of the sampled 
+    // columns of all clients. A randomized range finder (Halko et al., 2011)
+    // gives Q, then the eigendecomposition of the Gram matrix of Q^T Xs gives
+    // the leading singular triplets, whose dominant nonnegative parts 
+    // initialize atoms and coefficients. Sums over columns are accumulated 
+    // in init_table, whose rows are
+    //   [0, r): Xs Omega, where r is rank plus oversampling
+    //   [r, 2r): Gram matrix of Q^T Xs
+    //   [2r, 2r + 4): squared norms of positive and negative parts of the 
+    //   right and the left singular vectors
+    int NMFEngine::InitNNDSVD(int thread_id, const Eigen::MatrixXf & Xs, 
+            const std::vector<int> & sample_cols, 
+            const std::vector<int> & atoms, Eigen::MatrixXf & W,
+            petuum::Table<float> & init_table, std::mt19937 & rng) {
+        const int oversample = 10;
+        int m = Xs.rows(), p = Xs.cols();
+        // All threads agree on the rank, which is bounded by the expected 
+        // number of sampled columns
+        int rank = (nndsvd_rank_ > 0)? 
+            std::min(nndsvd_rank_, init_dictionary_size_): 
+            init_dictionary_size_;
+        rank = std::min(rank, 
+                std::min(m, int(n_ * init_sample_fraction_)) - oversample);
+        if (rank <= 0) {
+            if (client_id_ == 0 && thread_id == 0) {
+                LOG(INFO) << "Too few sampled columns for nndsvd, "
+                    "initializing B with sampled columns";
+            }
+            return 0;
+        }
+        int r = rank + oversample;
+
+        // Range finder
+        std::normal_distribution<float> normal(0.0, 1.0);
+        Eigen::MatrixXf Omega(p, r);
+        for (int i = 0; i < p; ++i) {
+            for (int c = 0; c < r; ++c) {
+                Omega(i, c) = normal(rng);
             }
-            B_table.BatchInc(row_id, B_update);
+        }
+        IncRows(init_table, 0, Xs * Omega);
+        petuum::PSTableGroup::GlobalBarrier();
+        if (thread_id == 0) {
+            Eigen::MatrixXf Y(m, r);
+            FetchRows(init_table, 0, Y);
+            Eigen::HouseholderQR<Eigen::MatrixXf> qr(Y);
+            nndsvd_Q_ = qr.householderQ() * Eigen::MatrixXf::Identity(m, r);
+        }
+        petuum::PSTableGroup::GlobalBarrier();
+
+        // Singular triplets from the Gram matrix of projected columns
+        Eigen::MatrixXf P = Xs.transpose() * nndsvd_Q_;
+        IncRows(init_table, r, P.transpose() * P);
+        petuum::PSTableGroup::GlobalBarrier();
+        if (thread_id == 0) {
+            Eigen::MatrixXf G(r, r);
+            FetchRows(init_table, r, G);
+            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXf> eig(G);
+            nndsvd_U_.resize(r, rank);
+            nndsvd_sigma_.resize(rank);
+            // eigenvalues are in increasing order
+            for (int c = 0; c < rank; ++c) {
+                nndsvd_U_.col(c) = eig.eigenvectors().col(r - 1 - c);
+                nndsvd_sigma_(c) = 
+                    sqrt(std::max(eig.eigenvalues()(r - 1 - c), 0.0f));
+            }
+        }
+        petuum::PSTableGroup::GlobalBarrier();
+
+        // Right singular vectors of sampled columns, and left singular 
+        // vectors of owned atoms
+        Eigen::MatrixXf V = P * nndsvd_U_;
+        for (int c = 0; c < rank; ++c) {
+            if (nndsvd_sigma_(c) > INFINITESIMAL) {
+                V.col(c) /= nndsvd_sigma_(c);
+            } else {
+                V.col(c).setZero();
+            }
+        }
+        int num_filled = 0;
+        while (num_filled < int(atoms.size()) && atoms[num_filled] < rank)
+            ++num_filled;
+        Eigen::MatrixXf U(m, num_filled);
+        Eigen::MatrixXf norms = Eigen::MatrixXf::Zero(rank, 4);
+        norms.col(0) = V.cwiseMax(0.0).colwise().squaredNorm().transpose();
+        norms.col(1) = (-V).cwiseMax(0.0).colwise().squaredNorm().transpose();
+        for (int a = 0; a < num_filled; ++a) {
+            U.col(a) = nndsvd_Q_ * nndsvd_U_.col(atoms[a]);
+            norms(atoms[a], 2) = U.col(a).cwiseMax(0.0).squaredNorm();
+            norms(atoms[a], 3) = (-U.col(a)).cwiseMax(0.0).squaredNorm();
+        }
+        IncRows(init_table, 2 * r, norms);
+        petuum::PSTableGroup::GlobalBarrier();
+        FetchRows(init_table, 2 * r, norms);
+
+        // Keep the positive or negative part of each singular pair, whichever
+        // has larger norm
+        Eigen::VectorXf scale(rank), v_norm(rank);
+        std::vector<bool> positive(rank);
+        for (int c = 0; c < rank; ++c) {
+            float pos = sqrt(norms(c, 0) * norms(c, 2));
+            float neg = sqrt(norms(c, 1) * norms(c, 3));
+            positive[c] = (pos >= neg);
+            scale(c) = sqrt(nndsvd_sigma_(c) * std::max(pos, neg));
+            v_norm(c) = sqrt(positive[c]? norms(c, 0): norms(c, 1));
+        }
+        for (int a = 0; a < num_filled; ++a) {
+            int c = atoms[a];
+            float u_norm = sqrt(positive[c]? norms(c, 2): norms(c, 3));
+            if (u_norm > INFINITESIMAL) {
+                W.col(a) = (positive[c]? U.col(a): (-U.col(a)).eval())
+                    .cwiseMax(0.0) * (scale(c) / u_norm);
+            }
+        }
+        // Coefficients of sampled columns
+        Eigen::VectorXf Sj(dictionary_size_), Sj_inc(dictionary_size_);
+        for (int i = 0; i < p; ++i) {
+            S_matrix_loader_.GetCol(sample_cols[i], Sj);
+            Sj_inc = -Sj;
+            for (int c = 0; c < rank; ++c) {
+                float v = positive[c]? V(i, c): -V(i, c);
+                if (v > 0.0 && v_norm(c) > INFINITESIMAL)
+                    Sj_inc(c) += scale(c) * v / v_norm(c);
+            }
+            S_matrix_loader_.IncCol(sample_cols[i], Sj_inc, 0.0);
+        }
+        if (client_id_ == 0 && thread_id == 0) {
+            LOG(INFO) << "nndsvd of rank " << rank << " done, leading "
+                "singular value: " << nndsvd_sigma_(0);
+        }
+        return num_filled;
+    }
+
+    // Warm start S_j by the exact minimizer of ||X_j - B S_j||^2 along the
+    // projected gradient direction max(0, B^T X_j) from S_j = 0
+    void NMFEngine::WarmStartS(int thread_id, const Eigen::MatrixXf & B, 
+            const std::vector<int> & skip_cols) {
+        int m = X_matrix_loader_.GetM();
+        int client_n = X_matrix_loader_.GetClientN();
+        Eigen::VectorXf Sj(dictionary_size_), Xj(m), direction(dictionary_size_);
+        for (int j = thread_id; j < client_n; j += num_worker_threads_) {
+            if (std::binary_search(skip_cols.begin(), skip_cols.end(), j))
+                continue;
+            S_matrix_loader_.GetCol(j, Sj);
+            X_matrix_loader_.GetCol(j, Xj);
+            direction = (B.transpose() * Xj).cwiseMax(0.0);
+            float curvature = (B * direction).squaredNorm();
+            Eigen::VectorXf Sj_inc = -Sj;
+            if (curvature > INFINITESIMAL) {
+                Sj_inc += (direction.squaredNorm() / curvature) * direction;
+            }
+            S_matrix_loader_.IncCol(j, Sj_inc, 0.0);
         }
     }
 
@@ -331,22 +1087,57 @@ namespace NMF {
             petuum::PSTableGroup::GetTableOrDie<float>(0);
         petuum::Table<float> loss_table = 
             petuum::PSTableGroup::GetTableOrDie<float>(1);
+        // Get moment tables of the adaptive optimizers of B
+        petuum::Table<float> B_sq_table = 
+            petuum::PSTableGroup::GetTableOrDie<float>(2);
+        petuum::Table<float> B_mean_table = 
+            petuum::PSTableGroup::GetTableOrDie<float>(3);
+        // Get scratch table of initialization
+        petuum::Table<float> init_table = 
+            petuum::PSTableGroup::GetTableOrDie<float>(5);
+        // Get atom usage table of pruning
+        petuum::Table<float> usage_table = 
+            petuum::PSTableGroup::GetTableOrDie<float>(6);
 
         // size of matrices
         int m = X_matrix_loader_.GetM();
         int client_n = X_matrix_loader_.GetClientN();
 
-        // Cache dictionary table 
+        // Atoms in use, to which the computation and the fetch of B are 
+        // restricted, starting from the first init_dictionary_size_ rows
+        std::vector<int> active_atoms(init_dictionary_size_);
+        std::iota(active_atoms.begin(), active_atoms.end(), 0);
+        std::vector<int> all_atoms(dictionary_size_);
+        std::iota(all_atoms.begin(), all_atoms.end(), 0);
+        // Cache dictionary table restricted to active atoms
         Eigen::MatrixXf petuum_table_cache(m, dictionary_size_);
-        // Accumulate update of dictionary table in minibatch
-        Eigen::MatrixXf petuum_update_cache(m, dictionary_size_);
-        // Cache a column of coefficients S
-	    Eigen::VectorXf Sj(dictionary_size_);
-        // Cache a column of update of S_j
-	    Eigen::VectorXf Sj_inc(dictionary_size_);
+        // Accumulate negative gradient of dictionary table in minibatch
+        Eigen::MatrixXf petuum_update_cache;
+        // Cache a column of coefficients S and its active part
+	    Eigen::VectorXf S_full(dictionary_size_), Sj;
         // Cache a column of data X 
 	    Eigen::VectorXf Xj(m);
 	    Eigen::VectorXf Xj_inc(m);
+        // Nonzeros of X_j, and if X is sparse, B^T, B^T B and B^T X_j, with 
+        // which the gradient of S_j costs O(k nnz(X_j)) instead of O(m k) 
+        std::vector<int> Xj_idx;
+        std::vector<float> Xj_val;
+        Eigen::MatrixXf B_transpose, B_gram;
+        Eigen::VectorXf BtXj;
+        // With the masked objective, the rows of B and entries of X_j at the 
+        // observed entries, and the features observed in the minibatch, to 
+        // which the update of B is restricted. The kl objective works on the
+        // nonzeros of X_j in the same way, with column sums of B and the sum
+        // of columns of S in the minibatch for the terms of zeros
+        bool masked = (objective_ == "masked");
+        bool kl = (objective_ == "kl");
+        bool nonzeros_X = sparse_X_ || kl;
+        Eigen::MatrixXf B_obs;
+        Eigen::VectorXf Xj_obs, BSj_obs, B_colsum, S_sum;
+        std::vector<char> feature_used(masked? m: 0);
+        std::vector<int> minibatch_features;
+        // Cache B S_j and B_anchor S_j
+        Eigen::VectorXf BSj(m), anchor_BSj(m);
         // Cache a row of dictionary table
         std::vector<float> petuum_row_cache(m);
 	
@@ -355,16 +1146,31 @@ namespace NMF {
         if (client_id_ == 0 && thread_id == 0) {
             LOG(INFO) << "starting to initialize B";
         }
+        // columns of S initialized along with B
+        std::vector<int> init_cols;
         if (load_cache_) {// load B and S from cache
             LoadCache(thread_id, B_table);
-	    } else { // randomly init B to have unit norm
-            if (client_id_ == 0)
-                InitRand(thread_id, B_table);
-	    }
+	    } else if (init_method_ == "random") { // randomly init B
+            InitRand(thread_id, B_table);
+	    } else { // init B from data
+            InitFromData(thread_id, B_table, init_table, init_cols);
+        }
         if (thread_id == 0 && client_id_ == 0) {
             LOG(INFO) << "matrix B initialization finished!";
         }
         petuum::PSTableGroup::GlobalBarrier();
+        // Fit S to the initialized B
+        if (!load_cache_ && init_method_ != "random") {
+            FetchB(B_table, petuum_table_cache, all_atoms);
+            WarmStartS(thread_id, petuum_table_cache, init_cols);
+        }
+        // Rows beyond the initial dictionary start inactive, and hence 0
+        if (dictionary_size_ > init_dictionary_size_) {
+            petuum::PSTableGroup::GlobalBarrier();
+            ClearAtoms(thread_id, B_table, std::vector<int>(
+                        all_atoms.begin() + init_dictionary_size_, 
+                        all_atoms.end()));
+        }
         STATS_APP_INIT_END();
 
         // Optimization Loop
@@ -373,9 +1179,58 @@ namespace NMF {
             boost::posix_time::microsec_clock::local_time();
         // Step size for optimization
         float step_size_B = init_step_size_B_, step_size_S = init_step_size_S_;
+        // Largest eigenvalue of B^T B and its eigenvector by power iteration,
+        // which is indexed by atom so that it warm starts the estimation on 
+        // any subset of atoms
+        float lipschitz_S = 0.0;
+        Eigen::VectorXf power_vec_atoms = 
+            Eigen::VectorXf::Ones(dictionary_size_), power_vec;
+        // Initial step sizes estimated by auto_step_size_ at minibatch 
+        // auto_step_minibatch, from which the step size schedules decay
+        float auto_init_step_size_B = init_step_size_B_, 
+              auto_init_step_size_S = init_step_size_S_;
+        int auto_step_minibatch = 0;
+        // Columns of S and X of the minibatch to estimate step size of B 
+        Eigen::MatrixXf S_block, X_block;
+        Eigen::VectorXf power_vec_S = Eigen::VectorXf::Ones(minibatch_size_), 
+            power_vec_X = Eigen::VectorXf::Ones(minibatch_size_);
+
+        bool svrg = (B_variance_reduction_ == "svrg");
+        petuum::Table<float> anchor_table = 
+            petuum::PSTableGroup::GetTableOrDie<float>(4);
+
+        // Sum of coefficients of each atom over the epoch and the totals of 
+        // usage_table, which are tracked if atoms are pruned
+        bool prune = (atom_prune_tol_ > 0.0);
+        Eigen::VectorXf atom_usage = Eigen::VectorXf::Zero(dictionary_size_), 
+            usage_total = Eigen::VectorXf::Zero(dictionary_size_);
+        // Evaluations before the last growth of the dictionary are not 
+        // compared by the convergence check
+        int first_eval = 0;
+        bool atoms_changed = false;
+
+        // Atoms fetched and updated in the current minibatch, and the 
+        // columns sampled ahead if they are a subset of active atoms
+        std::vector<int> minibatch_atoms = active_atoms;
+        std::vector<char> atom_used(B_subset_fetch_? dictionary_size_: 0);
+        std::vector<int> minibatch_cols(minibatch_size_);
+        std::vector<float> minibatch_weights(minibatch_size_);
+        std::vector<bool> minibatch_sampled(minibatch_size_);
+        std::vector<Eigen::VectorXf> minibatch_S(B_subset_fetch_? 
+                minibatch_size_: 0, Eigen::VectorXf(dictionary_size_));
+        long num_fetched_atoms = 0;
 
         int num_minibatch = 0;
         for (int iter = 0; iter < num_epochs_; ++iter) {
+            // Refresh anchor of svrg at the beginning of epochs, and whenever
+            // the active set has changed
+            if (svrg && (iter % svrg_refresh_epochs_ == 0 || atoms_changed)) {
+                petuum::PSTableGroup::GlobalBarrier();
+                FetchB(B_table, petuum_table_cache, active_atoms);
+                RefreshAnchor(thread_id, anchor_table, petuum_table_cache, 
+                        active_atoms);
+            }
+            atoms_changed = false;
             // how many minibatches per epoch
             int minibatch_per_epoch = (client_n / num_worker_threads_ > 0)? 
                 client_n / num_worker_threads_: 1;
@@ -395,22 +1250,40 @@ namespace NMF {
                     petuum::PSTableGroup::DeregisterThread();
 		            return;
 		        }
-                // Update petuum table cache
-		        //LOG(INFO) << "starting update table cache";
-                petuum::RowAccessor row_acc;
-                for (int row_id = 0; row_id < dictionary_size_; ++row_id) {
-                    B_table.Get(row_id, &row_acc);
-                    const petuum::DenseRow<float> & petuum_row = 
-                        row_acc.Get<petuum::DenseRow<float> >();
-                    petuum_row.CopyToVector(&petuum_row_cache);
-                    for (int col_id = 0; col_id < m; ++col_id) {
-                        petuum_table_cache(col_id, row_id) = 
-                            petuum_row_cache[col_id];
+                bool evaluate = (num_minibatch % num_eval_minibatch_ == 0);
+                bool estimate_step_size = auto_step_size_ && 
+                    num_minibatch % auto_step_size_interval_ == 0;
+                // Minibatches other than full sweeps only fetch and update 
+                // the atoms used by their columns, which are sampled ahead
+                bool full_sweep = !B_subset_fetch_ || evaluate || 
+                    estimate_step_size || 
+                    num_minibatch % B_full_fetch_interval_ == 0;
+                if (full_sweep) {
+                    minibatch_atoms = active_atoms;
+                } else {
+                    std::fill(atom_used.begin(), atom_used.end(), 0);
+                    for (int k = 0; k < minibatch_size_; ++k) {
+                        minibatch_sampled[k] = SampleCol(minibatch_cols[k], 
+                                minibatch_S[k], minibatch_weights[k]);
+                        if (!minibatch_sampled[k])
+                            continue;
+                        for (int row_id: active_atoms) {
+                            if (minibatch_S[k](row_id) > 0.0)
+                                atom_used[row_id] = 1;
+                        }
+                    }
+                    minibatch_atoms.clear();
+                    for (int row_id: active_atoms) {
+                        if (atom_used[row_id])
+                            minibatch_atoms.push_back(row_id);
                     }
                 }
+                num_fetched_atoms += minibatch_atoms.size();
+                // Update petuum table cache
+                FetchB(B_table, petuum_table_cache, minibatch_atoms);
 		        //LOG(INFO) << "finished starting update table cache";
 		        // evaluate obj
-		        if (num_minibatch % num_eval_minibatch_ == 0) {
+		        if (evaluate) {
 	    	        boost::posix_time::time_duration elapTime = 
                         boost::posix_time::microsec_clock::local_time() - beginT;
                     //LOG(INFO) <<"evaluating obj";
@@ -419,6 +1292,11 @@ namespace NMF {
 		            int num_samples = num_eval_samples_;
                     petuum_table_cache = ( (petuum_table_cache.array() > 0).
                         cast<float>() * petuum_table_cache.array() ).matrix();
+                    // kl evaluates the zeros of X_j through the column sums
+                    // of B, which are shared by all samples
+                    if (kl)
+                        B_colsum = petuum_table_cache.colwise().sum()
+                            .transpose();
                     //for (int i = 0; i < dictionary_size_; i++) {
                     //    float regularizer = petuum_table_cache.col(i).norm();
                     //    regularizer = 
@@ -426,10 +1304,43 @@ namespace NMF {
                     //    petuum_table_cache.col(i) *= regularizer;
                     //}
                     for (int i = 0; i < num_samples; i++) {
-                        int col_id_client = 0;
-                        if (S_matrix_loader_.GetRandCol(col_id_client, Sj) 
-                                && X_matrix_loader_.GetCol(col_id_client, Xj)) {
-				            Xj_inc = Xj - petuum_table_cache * Sj;
+                        // sample uniformly regardless of the sampling 
+                        // priority of S so that the loss is unbiased. Out of
+                        // core columns are sampled among resident blocks, 
+                        // which are a random subset of blocks, without 
+                        // driving the prefetches of the training samples
+                        int col_id_client;
+                        if (X_matrix_loader_.GetUniformColId(col_id_client)
+                                && S_matrix_loader_.GetCol(col_id_client, 
+                                    S_full) 
+                                && (nonzeros_X? X_matrix_loader_.GetSparseCol(
+                                        col_id_client, Xj_idx, Xj_val): 
+                                    X_matrix_loader_.GetCol(col_id_client, 
+                                        Xj))) {
+                            GatherAtoms(S_full, active_atoms, Sj);
+                            if (masked || kl) {
+                                // only nonzeros of X_j are visited
+                                Xj_obs = Eigen::Map<const Eigen::VectorXf>(
+                                        Xj_val.data(), Xj_val.size());
+                                BSj_obs.resize(Xj_idx.size());
+                                for (int p = 0; p < (int)Xj_idx.size(); ++p) {
+                                    BSj_obs(p) = petuum_table_cache.row(
+                                            Xj_idx[p]).dot(Sj);
+                                }
+                                if (masked) {
+                                    obj += (Xj_obs - BSj_obs).squaredNorm();
+                                } else {
+                                    obj += KLDivergence(Xj_obs, BSj_obs, 
+                                            B_colsum.dot(Sj));
+                                }
+                                continue;
+                            }
+                            SparseProduct(petuum_table_cache, Sj, 
+                                    sparse_product_density_, BSj);
+                            if (sparse_X_)
+                                SparseResidual(Xj_idx, Xj_val, BSj, Xj_inc);
+                            else
+                                Xj_inc = Xj - BSj;
 				            obj += Xj_inc.squaredNorm();
                         }
                     }
@@ -437,6 +1348,13 @@ namespace NMF {
                     LOG(INFO) << "iter: " << num_minibatch << ", client " 
                         << client_id_ << ", thread " << thread_id <<
                         " average loss: " << obj;
+                    if (B_subset_fetch_ && num_minibatch > 0 && 
+                            client_id_ == 0 && thread_id == 0) {
+                        LOG(INFO) << "atoms fetched per minibatch: " 
+                            << float(num_fetched_atoms) / num_eval_minibatch_
+                            << " of " << active_atoms.size();
+                    }
+                    num_fetched_atoms = 0;
                     // update loss table
                     loss_table.Inc(client_id_ * num_eval_per_client_ + 
                             num_minibatch / num_eval_minibatch_,  0, 
@@ -447,56 +1365,235 @@ namespace NMF {
                             / num_worker_threads_);
         	    	beginT = boost::posix_time::microsec_clock::local_time();
 		        }
-                step_size_B = init_step_size_B_ * 
-                    pow(step_size_offset_B_ + num_minibatch, 
+                // Lipschitz constant of the gradient of S_j, which is 
+                // needed by fista and auto step size
+                if (S_optimizer_ == "fista" || estimate_step_size) {
+                    GatherAtoms(power_vec_atoms, minibatch_atoms, power_vec);
+                    lipschitz_S = EstimateSquaredNorm(petuum_table_cache, 
+                            power_vec, num_power_iter_);
+                    for (int i = 0; i < (int)minibatch_atoms.size(); ++i) {
+                        power_vec_atoms(minibatch_atoms[i]) = power_vec(i);
+                    }
+                }
+                if (kl) {
+                    // B S_j of the kl objective has to stay positive, while the
+                    // cache may hold entries that have not been non-negativised
+                    petuum_table_cache = petuum_table_cache.cwiseMax(0.0);
+                    B_colsum = petuum_table_cache.colwise().sum().transpose();
+                    S_sum.setZero(minibatch_atoms.size());
+                }
+                if (nonzeros_X) {
+                    B_transpose = petuum_table_cache.transpose();
+                    if (objective_ == "frobenius") {
+                        B_gram.noalias() = B_transpose * petuum_table_cache;
+                    }
+                }
+                if (estimate_step_size) {
+                    // step size of S at the current minibatch is 1/L, 
+                    // with a small margin as power iteration underestimates L
+                    auto_step_minibatch = num_minibatch;
+                    if (lipschitz_S > INFINITESIMAL) 
+                        auto_init_step_size_S = 1.0 / (1.05 * lipschitz_S);
+                    S_block.resize(minibatch_atoms.size(), minibatch_size_);
+                    X_block.resize(m, minibatch_size_);
+                    S_block.setZero();
+                    X_block.setZero();
+                }
+                if (auto_step_size_) {
+                    // Decay from the estimated step sizes by the schedules
+                    step_size_B = auto_init_step_size_B * pow(
+                            std::max(step_size_offset_B_ + num_minibatch, 1.0f)
+                            / std::max(step_size_offset_B_ + 
+                                auto_step_minibatch, 1.0f), 
                             -1*step_size_pow_B_);
-                step_size_S = init_step_size_S_ * 
-                    pow(step_size_offset_S_ + num_minibatch, 
+                    step_size_S = auto_init_step_size_S * pow(
+                            std::max(step_size_offset_S_ + num_minibatch, 1.0f)
+                            / std::max(step_size_offset_S_ + 
+                                auto_step_minibatch, 1.0f), 
                             -1*step_size_pow_S_);
+                } else {
+                    step_size_B = init_step_size_B_ * 
+                        pow(step_size_offset_B_ + num_minibatch, 
+                                -1*step_size_pow_B_);
+                    step_size_S = init_step_size_S_ * 
+                        pow(step_size_offset_S_ + num_minibatch, 
+                                -1*step_size_pow_S_);
+                }
 		        num_minibatch++;
             	// clear update table
-                petuum_update_cache.fill(0.0);
+                petuum_update_cache.setZero(m, minibatch_atoms.size());
+                std::fill(feature_used.begin(), feature_used.end(), 0);
                 // minibatch
-                std::vector<float> Sj_inc_debug(num_iter_S_per_minibatch_);
-                for(int i = 0; i < num_iter_S_per_minibatch_; ++i)
-                    Sj_inc_debug[i] = 0.0;
                 for (int k = 0; k < minibatch_size_; ++k) {
                     int col_id_client = 0;
-                    if (S_matrix_loader_.GetRandCol(col_id_client, Sj)
-                            && X_matrix_loader_.GetCol(col_id_client, Xj)) {
+                    // importance weight of the sampled column
+                    float weight = 1.0;
+                    bool sampled = false;
+                    if (full_sweep) {
+                        sampled = SampleCol(col_id_client, S_full, weight);
+                    } else if (minibatch_sampled[k]) {
+                        col_id_client = minibatch_cols[k];
+                        S_full = minibatch_S[k];
+                        weight = minibatch_weights[k];
+                        sampled = true;
+                    }
+                    if (sampled && (nonzeros_X? 
+                                X_matrix_loader_.GetSparseCol(col_id_client, 
+                                    Xj_idx, Xj_val): 
+                                X_matrix_loader_.GetCol(col_id_client, Xj))) {
                         // update S_j
-                        for (int iter_S = 0; 
-                                iter_S < num_iter_S_per_minibatch_; ++iter_S) {
-                            // compute gradient of Sj
-		                    Sj_inc = step_size_S * (petuum_table_cache.transpose() 
-                                    * (Xj - petuum_table_cache * Sj));
-                            S_matrix_loader_.IncCol(col_id_client, Sj_inc, 0.0);
-                        
-			                // get updated S_j
-			                S_matrix_loader_.GetCol(col_id_client, Sj);
-                            Sj_inc_debug[iter_S] += Sj_inc.array().abs().matrix().sum() / dictionary_size_ / minibatch_size_;
+                        GatherAtoms(S_full, minibatch_atoms, Sj);
+                        if (masked || kl) {
+                            // the masked objective of S_j is the objective 
+                            // of the observed entries of X_j and rows of B
+                            GatherRows(B_transpose, Xj_idx, B_obs);
+                            Xj_obs = Eigen::Map<const Eigen::VectorXf>(
+                                    Xj_val.data(), Xj_val.size());
+                            if (kl) {
+                                UpdateSKL(col_id_client, B_obs, Xj_obs, 
+                                        B_colsum, Sj, step_size_S, 
+                                        minibatch_atoms, S_full);
+                            } else {
+                                UpdateS(col_id_client, B_obs, Xj_obs, Sj, 
+                                        step_size_S, lipschitz_S, 
+                                        minibatch_atoms, S_full, B_gram, BtXj);
+                            }
+                            if (prune) {
+                                for (int i = 0; i < (int)minibatch_atoms.size();
+                                        ++i)
+                                    atom_usage(minibatch_atoms[i]) += Sj(i);
+                            }
+                            // update B at the observed entries
+                            SparseProduct(B_obs, Sj, sparse_product_density_, 
+                                    BSj_obs);
+                            if (kl) {
+                                // negative gradient of B is 
+                                // (X_j / (B S_j) - 1) S_j^T, where the part of
+                                // -1 S_j^T is added once per minibatch
+                                S_matrix_loader_.SetColResidual(col_id_client,
+                                        KLDivergence(Xj_obs, BSj_obs, 
+                                            B_colsum.dot(Sj)));
+                                Xj_inc = Xj_obs.array() / BSj_obs.array().max(
+                                        float(INFINITESIMAL));
+                                S_sum += weight * Sj;
+                            } else {
+                                Xj_inc = Xj_obs - BSj_obs;
+                                S_matrix_loader_.SetColResidual(col_id_client,
+                                        Xj_inc.norm());
+                            }
+                            Xj_inc *= weight;
+                            MaskedRankOneUpdate(petuum_update_cache, Xj_idx, 
+                                    Xj_inc, Sj);
+                            if (masked) {
+                                for (int i: Xj_idx)
+                                    feature_used[i] = 1;
+                            }
+                            if (estimate_step_size) {
+                                S_block.col(k) = Sj;
+                                for (int p = 0; p < (int)Xj_idx.size(); ++p)
+                                    X_block(Xj_idx[p], k) = Xj_val[p];
+                            }
+                            continue;
+                        }
+                        if (sparse_X_) {
+                            SparseTransposeProduct(B_transpose, Xj_idx, 
+                                    Xj_val, BtXj);
+                        }
+                        UpdateS(col_id_client, petuum_table_cache, Xj, Sj, 
+                                step_size_S, lipschitz_S, minibatch_atoms, 
+                                S_full, B_gram, BtXj);
+                        if (prune) {
+                            for (int i = 0; i < (int)minibatch_atoms.size(); 
+                                    ++i)
+                                atom_usage(minibatch_atoms[i]) += Sj(i);
                         }
                         // update B
-			            Xj_inc = Xj - petuum_table_cache * Sj;
-			            petuum_update_cache.noalias() += 
-                            step_size_B * Xj_inc * Sj.transpose();
+                        SparseProduct(petuum_table_cache, Sj, 
+                                sparse_product_density_, BSj);
+                        if (sparse_X_)
+                            SparseResidual(Xj_idx, Xj_val, BSj, Xj_inc);
+                        else
+                            Xj_inc = Xj - BSj;
+                        S_matrix_loader_.SetColResidual(col_id_client, 
+                                Xj_inc.norm());
+                        // svrg subtracts the gradient at the anchor
+                        // dictionary, X_j - B S_j - (X_j - B_anchor S_j)
+                        // = B_anchor S_j - B S_j, whose mean over the
+                        // anchor columns is added back by the anchor 
+                        // gradient. The anchor shared by the threads is read
+                        // at the active atoms, which svrg fetches in full
+                        if (svrg) {
+                            anchor_BSj.setZero(m);
+                            for (int i = 0; i < (int)active_atoms.size(); ++i) {
+                                if (Sj(i) != 0.0)
+                                    anchor_BSj.noalias() += Sj(i) 
+                                        * svrg_anchor_B_.col(active_atoms[i]);
+                            }
+                            Xj_inc = anchor_BSj - BSj;
+                        }
+                        Xj_inc *= weight;
+                        SparseRankOneUpdate(petuum_update_cache, Xj_inc, Sj, 
+                                sparse_product_density_);
+                        if (estimate_step_size) {
+                            S_block.col(k) = Sj;
+                            if (sparse_X_) {
+                                for (int p = 0; p < (int)Xj_idx.size(); ++p)
+                                    X_block(Xj_idx[p], k) = Xj_val[p];
+                            } else {
+                                X_block.col(k) = Xj;
+                            }
+                        }
+                    }
+                }
+                if (estimate_step_size) {
+                    // Lipschitz constant of the gradient of B averaged over 
+                    // the minibatch is the largest eigenvalue of 
+                    // S_block S_block^T / minibatch_size_, the one of X_block
+                    // is logged as the scale of data
+                    float lipschitz_B = EstimateSquaredNorm(S_block, 
+                            power_vec_S, num_power_iter_) / minibatch_size_;
+                    float data_scale = EstimateSquaredNorm(X_block, 
+                            power_vec_X, num_power_iter_) / minibatch_size_;
+                    if (lipschitz_B > INFINITESIMAL && B_optimizer_ == "sgd") {
+                        auto_init_step_size_B = 1.0 / (1.05 * lipschitz_B);
+                        step_size_B = auto_init_step_size_B;
+                    }
+                    if (thread_id == 0) {
+                        LOG(INFO) << "iter: " << num_minibatch << ", client " 
+                            << client_id_ << " auto step size of B: " 
+                            << step_size_B << " (L = " << lipschitz_B 
+                            << "), S: " << step_size_S << " (L = " 
+                            << lipschitz_S << "), squared norm of sampled X "
+                            "per column: " << data_scale;
                     }
                 }
 		        // calculate updates
                 // Update B_table
-                for (int row_id = 0; row_id < dictionary_size_; ++row_id) {
-                    petuum::UpdateBatch<float> B_update;
-                    for (int col_id = 0; col_id < m; ++col_id) {
-                        B_update.Update(col_id, 
-                                petuum_update_cache(col_id, row_id) 
-                                / minibatch_size_);
+                if (kl)
+                    petuum_update_cache.rowwise() -= S_sum.transpose();
+                petuum_update_cache /= minibatch_size_;
+                if (svrg) {
+                    for (int i = 0; i < (int)active_atoms.size(); ++i) {
+                        petuum_update_cache.col(i) += 
+                            svrg_anchor_grad_.col(active_atoms[i]);
                     }
-                    B_table.BatchInc(row_id, B_update);
+                }
+                minibatch_features.clear();
+                for (int i = 0; i < (int)feature_used.size(); ++i) {
+                    if (feature_used[i])
+                        minibatch_features.push_back(i);
+                }
+                // an empty list of features updates all of them
+                if (!masked || !minibatch_features.empty()) {
+                    PushBUpdate(B_table, B_sq_table, B_mean_table, 
+                            petuum_update_cache, step_size_B, minibatch_atoms,
+                            minibatch_features);
                 }
                 petuum::PSTableGroup::Clock();
                 // Update B_table to non-negativise
+                petuum::RowAccessor row_acc;
                 std::vector<float> B_row_cache(m);
-                for (int row_id = 0; row_id < dictionary_size_; ++row_id) {
+                for (int row_id: minibatch_atoms) {
                     B_table.Get(row_id, &row_acc);
                     const petuum::DenseRow<float> & petuum_row = 
                         row_acc.Get<petuum::DenseRow<float> >();
@@ -513,6 +1610,70 @@ namespace NMF {
                 }
                 petuum::PSTableGroup::Clock(); 
             }
+            if (sparse_S_density_ > 0.0 && thread_id == 0) {
+                long nnz = 0;
+                int num_sparse_cols = 0;
+                S_matrix_loader_.GetStorageStats(nnz, num_sparse_cols);
+                LOG(INFO) << "epoch " << iter << ", client " << client_id_ 
+                    << " density of S: " << double(nnz) / 
+                    std::max(double(dictionary_size_) * client_n, 1.0) 
+                    << ", " << num_sparse_cols << " of " << client_n 
+                    << " columns stored sparsely";
+            }
+            // Check convergence and adapt the active set at the end of 
+            // epochs, where all worker threads see the same tables after the
+            // barrier and reach the same decisions
+            bool grow = (dictionary_size_ > init_dictionary_size_);
+            if (early_stop_tol_ > 0.0 || prune) {
+                if (prune) {
+                    petuum::UpdateBatch<float> usage_update;
+                    for (int row_id: active_atoms) {
+                        usage_update.Update(row_id, atom_usage(row_id));
+                    }
+                    usage_table.BatchInc(0, usage_update);
+                    atom_usage.setZero();
+                }
+                petuum::PSTableGroup::GlobalBarrier();
+                int num_pruned = 0, num_grown = 0;
+                if (prune) {
+                    std::vector<int> pruned_atoms;
+                    num_pruned = PruneAtoms(B_table, usage_table, 
+                            active_atoms, usage_total, pruned_atoms);
+                    // All threads have read B before pruned rows are cleared
+                    if (num_pruned > 0) {
+                        petuum::PSTableGroup::GlobalBarrier();
+                        ClearAtoms(thread_id, B_table, pruned_atoms);
+                    }
+                }
+                int num_evals = 0;
+                bool converged = early_stop_tol_ > 0.0 && 
+                    CheckConvergence(thread_id, loss_table, first_eval, 
+                            num_evals);
+                if (converged && grow && 
+                        (int)active_atoms.size() < dictionary_size_) {
+                    FetchB(B_table, petuum_table_cache, active_atoms);
+                    num_grown = GrowAtoms(thread_id, B_table, B_sq_table, 
+                            B_mean_table, petuum_table_cache, active_atoms);
+                    first_eval = num_evals;
+                    converged = false;
+                }
+                if (num_pruned > 0 || num_grown > 0) {
+                    atoms_changed = true;
+                    if (client_id_ == 0 && thread_id == 0) {
+                        LOG(INFO) << "epoch " << iter << ": pruned " 
+                            << num_pruned << " and added " << num_grown 
+                            << " atoms, " << active_atoms.size() 
+                            << " atoms active";
+                    }
+                }
+                if (converged) {
+                    if (client_id_ == 0 && thread_id == 0) {
+                        LOG(INFO) << "Loss converged after epoch " << iter 
+                            << ", terminating now!";
+                    }
+                    break;
+                }
+            }
         }
         // Save results to disk
         petuum::PSTableGroup::GlobalBarrier();
@@ -520,6 +1681,555 @@ namespace NMF {
         petuum::PSTableGroup::DeregisterThread();
     }
 
+    // Smoothed global loss of evaluation e is the exponential moving average 
+    // of the loss averaged over clients. Only evaluations recorded by all 
+    // clients are used
+    bool NMFEngine::CheckConvergence(int thread_id, 
+            petuum::Table<float> & loss_table, int first_eval, 
+            int & num_evals) {
+        petuum::RowAccessor row_acc;
+        std::vector<float> petuum_row_cache(1);
+        std::vector<double> smoothed_loss;
+        for (int iter = 0; iter < num_eval_per_client_; ++iter) {
+            double loss = 0.0;
+            bool complete = true;
+            for (int client = 0; client < num_clients_; ++client) {
+                int row_id = client * num_eval_per_client_ + iter;
+                loss_table.Get(row_id, &row_acc);
+                const petuum::DenseRow<float> & petuum_row = 
+                    row_acc.Get<petuum::DenseRow<float> >();
+                petuum_row.CopyToVector(&petuum_row_cache);
+                if (std::abs(petuum_row_cache[0]) > INFINITESIMAL) {
+                    loss += petuum_row_cache[0];
+                } else {
+                    complete = false;
+                    break;
+                }
+            }
+            if (!complete)
+                break;
+            loss /= num_clients_;
+            if (!smoothed_loss.empty()) {
+                loss = early_stop_smoothing_ * smoothed_loss.back() 
+                    + (1.0 - early_stop_smoothing_) * loss;
+            }
+            smoothed_loss.push_back(loss);
+        }
+        num_evals = smoothed_loss.size();
+        if (num_evals - 1 - early_stop_window_ < first_eval)
+            return false;
+        double prev = smoothed_loss[num_evals - 1 - early_stop_window_];
+        double curr = smoothed_loss[num_evals - 1];
+        double improvement = (prev - curr) / std::max(prev, 1e-12);
+        if (client_id_ == 0 && thread_id == 0) {
+            LOG(INFO) << "smoothed loss: " << curr << ", relative improvement "
+                "over last " << early_stop_window_ << " evaluations: " 
+                << improvement;
+        }
+        return improvement < early_stop_tol_;
+    }
+
+    // Time the dense product with B against gathering columns of B at 
+    // increasing densities of s, and return the largest density at which 
+    // gathering is still faster. B has at most 1024 columns as the crossover
+    // barely depends on k
+    float NMFEngine::CalibrateSparseProduct(int m, int k) {
+        const float densities[] = {0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.3, 
+            0.5};
+        int k_bench = std::min(k, 1024);
+        if (m <= 0 || k_bench <= 0)
+            return 0.0;
+        // Data is drawn from a local stream, which leaves rand() to sampling
+        std::seed_seq seq{random_seed_, 4u};
+        std::mt19937 rng(seq);
+        std::uniform_real_distribution<float> uniform(-1.0, 1.0);
+        Eigen::MatrixXf B(m, k_bench);
+        Eigen::VectorXf s(k_bench), Bs(m);
+        for (int j = 0; j < k_bench; ++j) {
+            for (int i = 0; i < m; ++i) {
+                B(i, j) = uniform(rng);
+            }
+            s(j) = uniform(rng);
+        }
+        // repeat to about 10^8 flops per measurement
+        int num_repeats = std::max(1, int(1e8 / (2.0 * m * k_bench)));
+        boost::posix_time::ptime beginT = 
+            boost::posix_time::microsec_clock::local_time();
+        for (int r = 0; r < num_repeats; ++r) {
+            Bs.noalias() = B * s;
+        }
+        float dense_time = (boost::posix_time::microsec_clock::local_time() 
+                - beginT).total_microseconds();
+        float max_density = 0.0;
+        for (float density: densities) {
+            s.setZero();
+            int nnz = std::max(1, int(density * k_bench));
+            for (int i = 0; i < nnz; ++i) {
+                s(i * k_bench / nnz) = 1.0;
+            }
+            beginT = boost::posix_time::microsec_clock::local_time();
+            for (int r = 0; r < num_repeats; ++r) {
+                SparseProduct(B, s, 1.0, Bs);
+            }
+            float sparse_time = (boost::posix_time::microsec_clock::local_time()
+                    - beginT).total_microseconds();
+            if (sparse_time >= dense_time)
+                break;
+            max_density = density;
+        }
+        LOG(INFO) << "product with B of " << m << " by " << k_bench 
+            << " takes " << dense_time / num_repeats << " us densely";
+        return max_density;
+    }
+
+    // Atoms are dead if their row norm of B, or their contribution, which is
+    // the row norm times the sum of coefficients in the epoch, is below 
+    // atom_prune_tol_ times the largest one among active atoms
+    int NMFEngine::PruneAtoms(petuum::Table<float> & B_table,
+            petuum::Table<float> & usage_table, 
+            std::vector<int> & active_atoms, Eigen::VectorXf & usage_total,
+            std::vector<int> & pruned_atoms) {
+        // usage_table accumulates over epochs, the usage of this epoch is the
+        // change since the last call
+        Eigen::MatrixXf usage_row(dictionary_size_, 1);
+        FetchRows(usage_table, 0, usage_row);
+        Eigen::VectorXf usage = usage_row.col(0) - usage_total;
+        usage_total = usage_row.col(0);
+        Eigen::MatrixXf B_cache;
+        FetchB(B_table, B_cache, active_atoms);
+        int num_atoms = active_atoms.size();
+        Eigen::VectorXf norms = B_cache.colwise().norm().transpose();
+        Eigen::VectorXf contributions(num_atoms);
+        for (int i = 0; i < num_atoms; ++i) {
+            contributions(i) = norms(i) * usage(active_atoms[i]);
+        }
+        float min_norm = atom_prune_tol_ * norms.maxCoeff(), 
+              min_contribution = atom_prune_tol_ * contributions.maxCoeff();
+        std::vector<int> alive_atoms;
+        pruned_atoms.clear();
+        for (int i = 0; i < num_atoms; ++i) {
+            if (norms(i) > min_norm && contributions(i) > min_contribution)
+                alive_atoms.push_back(active_atoms[i]);
+            else
+                pruned_atoms.push_back(active_atoms[i]);
+        }
+        // Nothing is pruned if no atom is alive
+        if (alive_atoms.empty()) {
+            pruned_atoms.clear();
+            return 0;
+        }
+        active_atoms.swap(alive_atoms);
+        return pruned_atoms.size();
+    }
+
+    // Inactive atoms are kept at 0, so that they are neither saved nor
+    // revived with stale coefficients when GrowAtoms reuses their rows. 
+    // Each row of B is cleared by the worker thread owning it as in 
+    // GrowAtoms, and the columns of S on a client are split among its 
+    // worker threads
+    void NMFEngine::ClearAtoms(int thread_id, 
+            petuum::Table<float> & B_table, const std::vector<int> & atoms) {
+        int num_threads = num_clients_ * num_worker_threads_;
+        int owner = client_id_ * num_worker_threads_ + thread_id;
+        for (int row_id: atoms) {
+            if (row_id % num_threads == owner)
+                ClearRow(B_table, row_id);
+        }
+        int client_n = S_matrix_loader_.GetClientN();
+        Eigen::VectorXf S_full(dictionary_size_), S_inc(dictionary_size_);
+        for (int col_id_client = thread_id; col_id_client < client_n; 
+                col_id_client += num_worker_threads_) {
+            if (!S_matrix_loader_.GetCol(col_id_client, S_full))
+                continue;
+            S_inc.setZero();
+            for (int row_id: atoms) {
+                S_inc(row_id) = -S_full(row_id);
+            }
+            S_matrix_loader_.IncCol(col_id_client, S_inc, 0.0);
+        }
+    }
+
+    // New atoms are the positive residual, scaled to unit norm, of the 
+    // column with the largest residual among a few sampled ones, and their 
+    // optimizer states of B are reset
+    int NMFEngine::GrowAtoms(int thread_id, petuum::Table<float> & B_table,
+            petuum::Table<float> & B_sq_table, 
+            petuum::Table<float> & B_mean_table, 
+            const Eigen::MatrixXf & B_cache, 
+            std::vector<int> & active_atoms) {
+        const int num_candidates = 8;
+        int m = X_matrix_loader_.GetM();
+        int client_n = X_matrix_loader_.GetClientN();
+        // New atoms take the lowest rows out of the active set
+        std::vector<int> new_atoms;
+        for (int row_id = 0, i = 0; row_id < dictionary_size_ && 
+                (int)new_atoms.size() < dictionary_growth_size_; ++row_id) {
+            if (i < (int)active_atoms.size() && active_atoms[i] == row_id) {
+                ++i;
+                continue;
+            }
+            new_atoms.push_back(row_id);
+        }
+        // Rows are dealt to worker threads of all clients in turn
+        int num_threads = num_clients_ * num_worker_threads_;
+        int owner = client_id_ * num_worker_threads_ + thread_id;
+        std::seed_seq seq{random_seed_, 3u, (unsigned)owner, 
+            (unsigned)active_atoms.size()};
+        std::mt19937 rng(seq);
+        Eigen::VectorXf S_full(dictionary_size_), Sj, Xj(m), residual(m), 
+            atom(m);
+        for (int row_id: new_atoms) {
+            if (row_id % num_threads != owner || client_n == 0)
+                continue;
+            atom.setZero();
+            for (int c = 0; c < num_candidates; ++c) {
+                int col_id_client = rng() % client_n;
+                if (!S_matrix_loader_.GetCol(col_id_client, S_full) 
+                        || !X_matrix_loader_.GetCol(col_id_client, Xj))
+                    continue;
+                GatherAtoms(S_full, active_atoms, Sj);
+                residual = (Xj - B_cache * Sj).cwiseMax(0.0);
+                if (residual.squaredNorm() > atom.squaredNorm())
+                    atom = residual;
+            }
+            float norm = atom.norm();
+            if (norm > INFINITESIMAL)
+                atom /= norm;
+            // The row is 0 as ClearAtoms keeps inactive rows
+            petuum::UpdateBatch<float> B_update;
+            for (int col_id = 0; col_id < m; ++col_id) {
+                B_update.Update(col_id, atom(col_id));
+            }
+            B_table.BatchInc(row_id, B_update);
+            if (B_optimizer_ != "sgd")
+                ClearRow(B_sq_table, row_id);
+            if (B_optimizer_ == "adam")
+                ClearRow(B_mean_table, row_id);
+        }
+        active_atoms.insert(active_atoms.end(), new_atoms.begin(), 
+                new_atoms.end());
+        std::sort(active_atoms.begin(), active_atoms.end());
+        // New atoms must be in place before they are fetched
+        petuum::PSTableGroup::GlobalBarrier();
+        return new_atoms.size();
+    }
+
+    // Copy rows atoms of B_table to B_cache
+    void NMFEngine::FetchB(petuum::Table<float> & B_table, 
+            Eigen::MatrixXf & B_cache, const std::vector<int> & atoms) {
+        int m = X_matrix_loader_.GetM();
+        B_cache.resize(m, atoms.size());
+        std::vector<float> petuum_row_cache;
+        petuum::RowAccessor row_acc;
+        for (int i = 0; i < (int)atoms.size(); ++i) {
+            B_table.Get(atoms[i], &row_acc);
+            const petuum::DenseRow<float> & petuum_row = 
+                row_acc.Get<petuum::DenseRow<float> >();
+            petuum_row.CopyToVector(&petuum_row_cache);
+            for (int col_id = 0; col_id < m; ++col_id) {
+                B_cache(col_id, i) = petuum_row_cache[col_id];
+            }
+        }
+    }
+
+    // Recompute anchor dictionary and anchor gradient of svrg. Each worker 
+    // thread accumulates the gradient over its share of columns into 
+    // anchor_table, which holds the anchor gradient of the last refresh, so 
+    // thread 0 of client 0 also subtracts the old anchor gradient
+    void NMFEngine::RefreshAnchor(int thread_id, 
+            petuum::Table<float> & anchor_table, 
+            const Eigen::MatrixXf & B_cache, const std::vector<int> & atoms) {
+        int m = X_matrix_loader_.GetM();
+        int client_n = X_matrix_loader_.GetClientN();
+        Eigen::MatrixXf anchor_grad_part = 
+            Eigen::MatrixXf::Zero(m, atoms.size());
+        Eigen::VectorXf S_full(dictionary_size_), Sj, Xj(m);
+        // Columns j = thread_id mod num_worker_threads_, subsampled with 
+        // stride 1 / svrg_anchor_fraction_
+        float stride = num_worker_threads_ / svrg_anchor_fraction_;
+        for (float pos = thread_id; pos < client_n; pos += stride) {
+            int col_id_client = int(pos);
+            if (S_matrix_loader_.GetCol(col_id_client, S_full) 
+                    && X_matrix_loader_.GetCol(col_id_client, Xj)) {
+                GatherAtoms(S_full, atoms, Sj);
+                anchor_grad_part.noalias() += 
+                    (Xj - B_cache * Sj) * Sj.transpose();
+            }
+        }
+        // Average over all sampled columns on all clients, atoms out of the 
+        // active set have zero anchor gradient
+        anchor_grad_part /= std::max(n_ * svrg_anchor_fraction_, 1.0f);
+        for (int i = 0; i < (int)atoms.size(); ++i) {
+            IncRows(anchor_table, atoms[i], anchor_grad_part.col(i));
+        }
+        if (client_id_ == 0 && thread_id == 0)
+            IncRows(anchor_table, 0, svrg_anchor_grad_, -1.0);
+        petuum::PSTableGroup::GlobalBarrier();
+        // Thread 0 of each client saves the new anchor
+        if (thread_id == 0) {
+            svrg_anchor_B_.setZero(m, dictionary_size_);
+            for (int i = 0; i < (int)atoms.size(); ++i) {
+                svrg_anchor_B_.col(atoms[i]) = B_cache.col(i);
+            }
+            FetchRows(anchor_table, 0, svrg_anchor_grad_);
+            if (client_id_ == 0) {
+                LOG(INFO) << "svrg anchor refreshed, norm of anchor gradient: "
+                    << svrg_anchor_grad_.norm();
+            }
+        }
+        petuum::PSTableGroup::GlobalBarrier();
+    }
+
+    // Push update of B given its negative gradient averaged over a minibatch
+    void NMFEngine::PushBUpdate(petuum::Table<float> & B_table, 
+            petuum::Table<float> & B_sq_table, 
+            petuum::Table<float> & B_mean_table,
+            const Eigen::MatrixXf & B_grad, float step_size_B, 
+            const std::vector<int> & atoms,
+            const std::vector<int> & features) {
+        int m = X_matrix_loader_.GetM();
+        int num_atoms = atoms.size();
+        std::vector<int> all_features;
+        if (features.empty()) {
+            all_features.resize(m);
+            std::iota(all_features.begin(), all_features.end(), 0);
+        }
+        const std::vector<int> & cols = features.empty()? all_features: 
+            features;
+        if (B_optimizer_ == "sgd") {
+            for (int i = 0; i < num_atoms; ++i) {
+                int row_id = atoms[i];
+                petuum::UpdateBatch<float> B_update;
+                for (int col_id: cols) {
+                    B_update.Update(col_id, step_size_B * B_grad(col_id, i));
+                }
+                B_table.BatchInc(row_id, B_update);
+            }
+            return;
+        }
+        bool per_entry = (B_optimizer_granularity_ == "entry");
+        bool adam = (B_optimizer_ == "adam");
+        petuum::RowAccessor row_acc;
+        std::vector<float> sq_cache(per_entry? m: 1), mean_cache(m + 1);
+        for (int i = 0; i < num_atoms; ++i) {
+            int row_id = atoms[i];
+            B_sq_table.Get(row_id, &row_acc);
+            row_acc.Get<petuum::DenseRow<float> >().CopyToVector(&sq_cache);
+            // Moments of a row are decayed by every update of the row, which
+            // adam corrects the bias of by the number of updates counted in 
+            // the last column of B_mean_table, up to the staleness of the 
+            // table. The count is reset with the row by GrowAtoms. Entries 
+            // out of the features of masked updates are counted as decayed
+            float bias1 = 1.0, bias2 = 1.0;
+            if (adam) {
+                B_mean_table.Get(row_id, &row_acc);
+                row_acc.Get<petuum::DenseRow<float> >().CopyToVector(
+                        &mean_cache);
+                float t = mean_cache[m] + 1.0;
+                bias1 = 1.0 - pow(adam_beta1_, t);
+                bias2 = 1.0 - pow(adam_beta2_, t);
+            }
+            petuum::UpdateBatch<float> B_update, sq_update, mean_update;
+            // second moment shared by the whole row
+            float row_sq = 0.0;
+            if (!per_entry) {
+                float g2 = 0.0;
+                for (int col_id: cols) {
+                    g2 += B_grad(col_id, i) * B_grad(col_id, i);
+                }
+                g2 /= std::max(int(cols.size()), 1);
+                float sq_inc = adam? (1.0 - adam_beta2_) * (g2 - sq_cache[0]):
+                    g2;
+                sq_update.Update(0, sq_inc);
+                row_sq = sq_cache[0] + sq_inc;
+            }
+            for (int col_id: cols) {
+                float g = B_grad(col_id, i);
+                float sq = row_sq;
+                if (per_entry) {
+                    float sq_inc = adam? 
+                        (1.0 - adam_beta2_) * (g * g - sq_cache[col_id]): g * g;
+                    sq_update.Update(col_id, sq_inc);
+                    sq = sq_cache[col_id] + sq_inc;
+                }
+                float direction = g;
+                if (adam) {
+                    float mean_inc = (1.0 - adam_beta1_) * 
+                        (g - mean_cache[col_id]);
+                    mean_update.Update(col_id, mean_inc);
+                    direction = (mean_cache[col_id] + mean_inc) / bias1;
+                }
+                B_update.Update(col_id, step_size_B * direction / 
+                        (sqrt(sq / bias2) + adaptive_epsilon_));
+            }
+            B_table.BatchInc(row_id, B_update);
+            B_sq_table.BatchInc(row_id, sq_update);
+            if (adam) {
+                mean_update.Update(m, 1.0);
+                B_mean_table.BatchInc(row_id, mean_update);
+            }
+        }
+    }
+
+    // Sample a column of S
+    bool NMFEngine::SampleCol(int & col_id_client, Eigen::VectorXf & S_full, 
+            float & weight) {
+        if (!X_matrix_loader_.IsOutOfCore())
+            return S_matrix_loader_.GetRandCol(col_id_client, S_full, weight);
+        return X_matrix_loader_.GetRandColId(col_id_client, weight) 
+            && S_matrix_loader_.GetCol(col_id_client, S_full);
+    }
+
+    // Update column col_id_client of S with B fixed
+    void NMFEngine::UpdateS(int col_id_client, const Eigen::MatrixXf & B, 
+            const Eigen::VectorXf & Xj, Eigen::VectorXf & Sj, 
+            float step_size_S, float lipschitz_S, 
+            const std::vector<int> & atoms, Eigen::VectorXf & S_full,
+            const Eigen::MatrixXf & gram, const Eigen::VectorXf & BtXj) {
+        int num_atoms = atoms.size();
+        Eigen::VectorXf grad(num_atoms);
+        // negative gradient B^T (X_j - B s), which is B^T X_j - B^T B s if 
+        // the Gram matrix is given
+        Eigen::VectorXf BS(gram.size() > 0? num_atoms: Xj.size());
+        auto neg_grad = [&](const Eigen::VectorXf & s) {
+            if (gram.size() > 0) {
+                SparseProduct(gram, s, sparse_product_density_, BS);
+                grad = BtXj - BS;
+            } else {
+                SparseProduct(B, s, sparse_product_density_, BS);
+                grad.noalias() = B.transpose() * (Xj - BS);
+            }
+        };
+        // projected gradient norm of the last iteration, the gradient norm
+        // is only computed if columns are checked for convergence
+        float grad_norm = 0.0;
+        bool check_convergence = (S_convergence_tol_ > 0.0);
+        Eigen::VectorXf S_prev = Sj;
+        if (S_optimizer_ == "pgd") {
+            for (int iter_S = 0; iter_S < num_iter_S_per_minibatch_; 
+                    ++iter_S) {
+                // compute negative gradient of Sj
+                neg_grad(S_prev);
+                if (check_convergence) {
+                    // entries of Sj at the bound 0 only count if they would
+                    // move away from it
+                    grad_norm = ((S_prev.array() > 0.0).select(grad.array(), 
+                                grad.array().max(0.0))).matrix().norm();
+                    if (grad_norm < S_convergence_tol_)
+                        break;
+                }
+                // each step is clamped as if written to S_matrix_loader_
+                S_prev += step_size_S * grad;
+                ClampS(S_prev);
+            }
+        } else if (lipschitz_S > INFINITESIMAL) {
+            // fista: accelerated projected gradient with step size 1/L, where
+            // momentum is restarted whenever the update direction and the 
+            // momentum disagree (O'Donoghue and Candes, 2012)
+            // power iteration underestimates L, leave a small margin
+            float step = 1.0 / (1.05 * lipschitz_S);
+            Eigen::VectorXf Y = Sj, S_next(num_atoms), D, BD;
+            float t = 1.0;
+            for (int iter_S = 0; iter_S < num_iter_S_per_minibatch_; 
+                    ++iter_S) {
+                neg_grad(Y);
+                // backtracking: as the objective is quadratic, the step 
+                // D = S_next - Y decreases it at least as much as the model
+                // with step size 1/L iff ||B D||^2 <= ||D||^2 / step. A step
+                // from an underestimated L is halved until this holds, and
+                // the momentum is restarted, so that fista cannot diverge
+                while (true) {
+                    S_next = (Y + step * grad).cwiseMax(0.0);
+                    D = S_next - Y;
+                    float D_sq = D.squaredNorm();
+                    if (D_sq <= 0.0)
+                        break;
+                    float BD_sq;
+                    if (gram.size() > 0) {
+                        BD.noalias() = gram * D;
+                        BD_sq = D.dot(BD);
+                    } else {
+                        BD.noalias() = B * D;
+                        BD_sq = BD.squaredNorm();
+                    }
+                    if (step * BD_sq <= D_sq)
+                        break;
+                    step *= 0.5;
+                    t = 1.0;
+                }
+                if (check_convergence) {
+                    // norm of the gradient mapping L * (Y - S_next)
+                    grad_norm = (S_next - Y).norm() / step;
+                    if (grad_norm < S_convergence_tol_) {
+                        S_prev = S_next;
+                        break;
+                    }
+                }
+                float t_next = (1.0 + sqrt(1.0 + 4.0 * t * t)) / 2.0;
+                if ((Y - S_next).dot(S_next - S_prev) > 0.0) {
+                    // adaptive restart
+                    t_next = 1.0;
+                    Y = S_next;
+                } else {
+                    Y = S_next + ((t - 1.0) / t_next) * (S_next - S_prev);
+                }
+                S_prev = S_next;
+                t = t_next;
+            }
+        }
+        WriteBackS(col_id_client, S_prev, grad_norm, atoms, Sj, S_full);
+    }
+
+    // Update column col_id_client of S with B fixed under the kl objective
+    void NMFEngine::UpdateSKL(int col_id_client, const Eigen::MatrixXf & B_obs,
+            const Eigen::VectorXf & Xj_obs, const Eigen::VectorXf & B_colsum,
+            Eigen::VectorXf & Sj, float step_size_S, 
+            const std::vector<int> & atoms, Eigen::VectorXf & S_full) {
+        Eigen::VectorXf S_prev = Sj, BS(Xj_obs.size()), grad;
+        float grad_norm = 0.0;
+        bool check_convergence = (S_convergence_tol_ > 0.0);
+        for (int iter_S = 0; iter_S < num_iter_S_per_minibatch_; ++iter_S) {
+            // B^T (X_j / (B S_j)) over the nonzeros of X_j, from which the 
+            // negative gradient subtracts B^T 1, the column sums of B
+            SparseProduct(B_obs, S_prev, sparse_product_density_, BS);
+            BS = Xj_obs.array() / BS.array().max(float(INFINITESIMAL));
+            grad.noalias() = B_obs.transpose() * BS;
+            if (check_convergence) {
+                grad_norm = ((S_prev.array() > 0.0).select(
+                            grad.array() - B_colsum.array(), 
+                            (grad.array() - B_colsum.array()).max(0.0)))
+                    .matrix().norm();
+                if (grad_norm < S_convergence_tol_)
+                    break;
+            }
+            if (S_optimizer_ == "mu") {
+                // multiplicative update S_j .* B^T (X_j / (B S_j)) ./ B^T 1
+                S_prev = S_prev.array() * grad.array() / 
+                    B_colsum.array().max(float(INFINITESIMAL));
+            } else {
+                S_prev = (S_prev + step_size_S * (grad - B_colsum))
+                    .cwiseMax(0.0);
+            }
+        }
+        WriteBackS(col_id_client, S_prev, grad_norm, atoms, Sj, S_full);
+    }
+
+    // Write back the accumulated change of S_j in a single increment, 
+    // zeroing the coefficients of atoms out of the active set
+    void NMFEngine::WriteBackS(int col_id_client, const Eigen::VectorXf & S_new,
+            float grad_norm, const std::vector<int> & atoms, 
+            Eigen::VectorXf & Sj, Eigen::VectorXf & S_full) {
+        Eigen::VectorXf S_inc = -S_full;
+        for (int i = 0; i < (int)atoms.size(); ++i) {
+            S_inc(atoms[i]) += S_new(i);
+        }
+        S_matrix_loader_.IncCol(col_id_client, S_inc, 0.0);
+        S_matrix_loader_.GetCol(col_id_client, S_full);
+        GatherAtoms(S_full, atoms, Sj);
+        if (S_convergence_tol_ > 0.0)
+            S_matrix_loader_.SetColGradNorm(col_id_client, grad_norm);
+    }
+
     NMFEngine::~NMFEngine() {
     }
 } // namespace NMF
@@ -1,6 +1,8 @@
 #pragma once
 #include <string>
 #include <atomic>
+#include <vector>
+#include <random>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <petuum_ps_common/include/petuum_ps.hpp>
 
@@ -20,7 +22,31 @@ class NMFEngine {
         float maximum_running_time_;
         
         // objective function parameters
+        // number of atoms B and S are allocated for, which is the upper 
+        // bound of dictionary growth
         int dictionary_size_;
+        // number of atoms initially in use and added per growth
+        int init_dictionary_size_, dictionary_growth_size_;
+        // Atoms are pruned if their row norm of B or contribution falls 
+        // below atom_prune_tol_ times the largest one
+        float atom_prune_tol_;
+        // Whether minibatches fetch and update only the atoms their columns
+        // of S use, with a sweep over all active atoms every 
+        // B_full_fetch_interval_ minibatches
+        bool B_subset_fetch_;
+        int B_full_fetch_interval_;
+        // Columns of S with at most this fraction of nonzeros are multiplied
+        // with B by gathering the columns of B at the nonzeros
+        float sparse_product_density_;
+        // Columns of S with at most this fraction of nonzeros are stored 
+        // sparsely
+        float sparse_S_density_;
+        // "frobenius": squared error over all entries of X
+        // "masked": squared error over the entries present in sparse X
+        // "kl": generalized KL divergence of B S from X
+        std::string objective_;
+        // number of columns of data on all clients
+        int n_;
 
         // minibatch and evaluate parameters
         int num_epochs_, minibatch_size_, num_eval_minibatch_, 
@@ -30,12 +56,82 @@ class NMFEngine {
         // optimization parameters
         float init_step_size_B_, step_size_offset_B_, step_size_pow_B_, 
               init_step_size_S_, step_size_offset_S_, step_size_pow_S_;
+        // "pgd": projected gradient with step size schedule for S
+        // "fista": accelerated projected gradient with step size 1/L
+        // "mu": multiplicative update of the kl objective
+        std::string S_optimizer_;
+        // number of power iterations to estimate L per refresh of B
+        int num_power_iter_;
+        // stop iterating on a column of S once its projected gradient norm 
+        // falls below S_convergence_tol_, and sample converged columns with 
+        // probability converged_col_sample_prob_ relative to others
+        float S_convergence_tol_, converged_col_sample_prob_;
+        // "uniform": sample columns uniformly
+        // "residual": sample columns proportionally to their residual norm,
+        // mixed with uniform sampling with probability 
+        // importance_sampling_uniform_mix_, and reweight gradient of B
+        std::string sampling_mode_;
+        float importance_sampling_uniform_mix_;
+        // "sgd": step size schedule of B applied to all entries
+        // "adagrad" or "adam": step size schedule of B scaled per entry by
+        // moments of the gradient kept in companion tables
+        std::string B_optimizer_;
+        // "entry" or "row": keep the second moment per entry or per row of B
+        std::string B_optimizer_granularity_;
+        float adaptive_epsilon_, adam_beta1_, adam_beta2_;
+        // "none": plain stochastic gradient of B
+        // "svrg": correct the stochastic gradient of B by an anchor gradient
+        // computed over all columns every svrg_refresh_epochs_ epochs, 
+        // using a fraction svrg_anchor_fraction_ of columns on each client
+        std::string B_variance_reduction_;
+        int svrg_refresh_epochs_;
+        float svrg_anchor_fraction_;
+        // Anchor dictionary and anchor gradient of svrg, shared by worker 
+        // threads on a client
+        Eigen::MatrixXf svrg_anchor_B_, svrg_anchor_grad_;
+
+        // Stop all workers at the end of an epoch once the relative 
+        // improvement of the smoothed global loss over the last 
+        // early_stop_window_ evaluations falls below early_stop_tol_, where 
+        // the loss is smoothed by an exponential moving average with factor 
+        // early_stop_smoothing_
+        float early_stop_tol_, early_stop_smoothing_;
+        int early_stop_window_;
+
+        // "random": init B with small random values
+        // "nndsvd": init B and sampled columns of S by nonnegative double 
+        // singular value decomposition of a randomized truncated SVD of a 
+        // fraction init_sample_fraction_ of columns, computed jointly by all 
+        // clients, with rank nndsvd_rank_
+        // "random_columns" or "kmeanspp": init B with sampled columns of X 
+        // chosen uniformly or by k-means++ seeding
+        // Columns of S not initialized by "nndsvd" are warm started by an 
+        // exact line search along the projected gradient from 0
+        std::string init_method_;
+        float init_sample_fraction_;
+        int nndsvd_rank_;
+        // Seed of random initialization
+        unsigned random_seed_;
+        // Randomized SVD of nndsvd shared by worker threads on a client: 
+        // orthonormal basis Q of the range of the sampled columns, 
+        // eigenvectors U and singular values sigma of the projected columns
+        Eigen::MatrixXf nndsvd_Q_, nndsvd_U_;
+        Eigen::VectorXf nndsvd_sigma_;
+
+        // Replace init_step_size_B_ and init_step_size_S_ by the inverse of 
+        // the Lipschitz constants estimated every auto_step_size_interval_ 
+        // minibatches
+        bool auto_step_size_;
+        int auto_step_size_interval_;
 
         // input and output
         std::string data_file_, input_data_format_, output_path_, 
             output_data_format_, cache_path_;
         bool is_partitioned_;
         bool load_cache_;
+        // Whether X is read from a sparse format, in which case the 
+        // gradient of S and residuals only touch the nonzeros of X
+        bool sparse_X_;
 
         // matrix loader for data X and dictionary S
         MatrixLoader<float> X_matrix_loader_, S_matrix_loader_;
@@ -43,14 +139,136 @@ class NMFEngine {
         // timer
         boost::posix_time::ptime initT_;
 
+        // Whether or not the global loss recorded in loss_table has converged.
+        // Shall be called after calling petuum::PSTableGroup::GlobalBarrier()
+        // by all worker threads, which then reach the same decision. Only 
+        // evaluations from first_eval on are compared, num_evals returns the 
+        // number of evaluations recorded by all clients
+        bool CheckConvergence(int thread_id, petuum::Table<float> & loss_table,
+                int first_eval, int & num_evals);
+
+        // Benchmark the product of an m-by-k dictionary with columns of S 
+        // and return the largest density at which the sparse product wins
+        float CalibrateSparseProduct(int m, int k);
+
+        // Remove dead atoms from the sorted active_atoms given usage_table, 
+        // which accumulates the coefficients of each atom over all epochs, 
+        // and usage_total, the totals seen at the last call. Shall be called 
+        // after a global barrier by all worker threads, which then reach the 
+        // same decision. Returns the number of pruned atoms, which are 
+        // listed in pruned_atoms
+        int PruneAtoms(petuum::Table<float> & B_table, 
+                petuum::Table<float> & usage_table, 
+                std::vector<int> & active_atoms, Eigen::VectorXf & usage_total,
+                std::vector<int> & pruned_atoms);
+
+        // Set the rows atoms of B and their coefficients in S to 0. Shall be
+        // called by all worker threads of all clients after a global barrier
+        void ClearAtoms(int thread_id, petuum::Table<float> & B_table, 
+                const std::vector<int> & atoms);
+
+        // Add up to dictionary_growth_size_ atoms to the sorted active_atoms,
+        // reusing the rows of pruned atoms first. Each new atom is 
+        // initialized by the worker thread owning its row with the positive 
+        // residual of a sampled column given B_cache, the dictionary 
+        // restricted to active_atoms. Shall be called by all worker threads 
+        // of all clients. Returns the number of added atoms
+        int GrowAtoms(int thread_id, petuum::Table<float> & B_table, 
+                petuum::Table<float> & B_sq_table, 
+                petuum::Table<float> & B_mean_table, 
+                const Eigen::MatrixXf & B_cache, 
+                std::vector<int> & active_atoms);
+
+        // Sample a column of S by its sampling priority as GetRandCol does, 
+        // or among the resident columns of X if X is out of core
+        bool SampleCol(int & col_id_client, Eigen::VectorXf & S_full, 
+                float & weight);
+
         // Save results to disk
         void SaveResults(int thread_id, petuum::Table<float> & B_table, 
                 petuum::Table<float> & loss_table);
        
+        // Copy rows atoms of B_table to B_cache, where column i of B_cache 
+        // is row atoms[i] of B_table
+        void FetchB(petuum::Table<float> & B_table, Eigen::MatrixXf & B_cache,
+                const std::vector<int> & atoms);
+
+        // Recompute the anchor of svrg from B_cache, the rows atoms of B, 
+        // which must have just been fetched after a global barrier. Must be 
+        // called by all worker threads of all clients
+        void RefreshAnchor(int thread_id, petuum::Table<float> & anchor_table,
+                const Eigen::MatrixXf & B_cache, 
+                const std::vector<int> & atoms);
+
+        // Scale the negative gradient of B averaged over a minibatch by the 
+        // optimizer of B and push the update to B_table, where column i of 
+        // B_grad is the gradient of row atoms[i]. Only the sorted entries 
+        // features of the rows are updated, or all entries if it is empty
+        void PushBUpdate(petuum::Table<float> & B_table, 
+                petuum::Table<float> & B_sq_table, 
+                petuum::Table<float> & B_mean_table,
+                const Eigen::MatrixXf & B_grad, float step_size_B, 
+                const std::vector<int> & atoms,
+                const std::vector<int> & features);
+
         // Init B with random values and normalize elements to have unit norm
         void InitRand(int thread_id, petuum::Table<float> & B_table);
 
         // Load B and S from disk
         void LoadCache(int thread_id, petuum::Table<float> & B_table);
+
+        // Rows of B initialized by worker thread thread_id on this client
+        std::vector<int> OwnedAtoms(int thread_id);
+
+        // Init B from data by init_method_. Every worker thread of every 
+        // client initializes the rows of B it owns from columns sampled from
+        // its share of X. init_table is the scratch table of nndsvd. 
+        // init_cols returns the columns of S that have been initialized
+        void InitFromData(int thread_id, petuum::Table<float> & B_table, 
+                petuum::Table<float> & init_table, std::vector<int> & init_cols);
+
+        // nndsvd part of InitFromData, where Xs holds the sampled columns 
+        // sample_cols, and the first columns of W, which are the owned atoms,
+        // are filled. Returns the number of filled atoms
+        int InitNNDSVD(int thread_id, const Eigen::MatrixXf & Xs, 
+                const std::vector<int> & sample_cols, 
+                const std::vector<int> & atoms, Eigen::MatrixXf & W,
+                petuum::Table<float> & init_table, std::mt19937 & rng);
+
+        // Warm start the share of columns of S of worker thread thread_id 
+        // given B, skipping the sorted columns skip_cols
+        void WarmStartS(int thread_id, const Eigen::MatrixXf & B, 
+                const std::vector<int> & skip_cols);
+
+        // Run num_iter_S_per_minibatch_ iterations on column col_id_client of
+        // S with dictionary B fixed, Sj holds the updated column on return.
+        // lipschitz_S is the largest eigenvalue of B^T B, only used by fista
+        // B and Sj are restricted to atoms, S_full is the whole column as 
+        // read from S, which is written back with the coefficients of other 
+        // atoms zeroed. If the Gram matrix gram = B^T B is not empty, the 
+        // gradient is computed from gram and BtXj = B^T X_j, and B and Xj are
+        // not used
+        void UpdateS(int col_id_client, const Eigen::MatrixXf & B, 
+                const Eigen::VectorXf & Xj, Eigen::VectorXf & Sj, 
+                float step_size_S, float lipschitz_S, 
+                const std::vector<int> & atoms, Eigen::VectorXf & S_full,
+                const Eigen::MatrixXf & gram, const Eigen::VectorXf & BtXj);
+
+        // UpdateS under the kl objective, where B_obs holds the rows of B at
+        // the nonzeros Xj_obs of column col_id_client of X, and B_colsum the
+        // column sums of B. S is updated by projected gradient with step 
+        // size step_size_S, or by multiplicative updates
+        void UpdateSKL(int col_id_client, const Eigen::MatrixXf & B_obs,
+                const Eigen::VectorXf & Xj_obs, 
+                const Eigen::VectorXf & B_colsum, Eigen::VectorXf & Sj, 
+                float step_size_S, const std::vector<int> & atoms, 
+                Eigen::VectorXf & S_full);
+
+        // Write S_new, column col_id_client of S restricted to atoms, back 
+        // to S and record its gradient norm grad_norm. Sj and S_full are
+        // reread from S
+        void WriteBackS(int col_id_client, const Eigen::VectorXf & S_new, 
+                float grad_norm, const std::vector<int> & atoms, 
+                Eigen::VectorXf & Sj, Eigen::VectorXf & S_full);
 };
 }; // namespace NMF
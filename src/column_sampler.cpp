@@ -0,0 +1,84 @@
+#include "column_sampler.hpp"
+
+#include <vector>
+#include <cstdlib>
+#include <mutex>
+#include <glog/logging.h>
+
+namespace NMF {
+
+// Constructor
+ColumnSampler::ColumnSampler(): n_(0), uniform_mix_(1.0), total_(0.0) {
+}
+
+// Init sampler with weights
+void ColumnSampler::Init(const std::vector<double> & weights, 
+        double uniform_mix) {
+    CHECK(uniform_mix >= 0.0 && uniform_mix <= 1.0) 
+        << "Uniform mixing probability must be within [0, 1]";
+    std::unique_lock<std::mutex> lck(mtx_);
+    n_ = weights.size();
+    uniform_mix_ = uniform_mix;
+    weights_.assign(n_, 0.0);
+    tree_.assign(n_ + 1, 0.0);
+    total_ = 0.0;
+    for (int j = 0; j < n_; ++j) {
+        CHECK(weights[j] >= 0.0) << "Weight of column " << j 
+            << " is negative";
+        AddWeight(j, weights[j]);
+    }
+}
+
+// Whether or not the sampler has been initialized
+bool ColumnSampler::IsInit() {
+    return n_ > 0;
+}
+
+// Set weight of column j
+void ColumnSampler::SetWeight(int j, double weight) {
+    std::unique_lock<std::mutex> lck(mtx_);
+    AddWeight(j, (weight > 0.0? weight: 0.0) - weights_[j]);
+}
+
+// Add inc to weight of column j
+void ColumnSampler::AddWeight(int j, double inc) {
+    weights_[j] += inc;
+    total_ += inc;
+    for (int i = j + 1; i <= n_; i += i & (-i)) {
+        tree_[i] += inc;
+    }
+}
+
+// Sample a column, prob is its probability of being sampled
+int ColumnSampler::Sample(double & prob) {
+    std::unique_lock<std::mutex> lck(mtx_);
+    int j = 0;
+    double u = double(rand()) / RAND_MAX;
+    // all weights vanish, e.g. data has been reconstructed perfectly
+    double mix = (total_ > 0.0)? uniform_mix_: 1.0;
+    if (u < mix) {
+        j = rand() % n_;
+    } else {
+        // Descend the Fenwick tree to the column whose prefix sum of weights
+        // first exceeds target
+        double target = (u - mix) / (1.0 - mix) * total_;
+        int pos = 0;
+        int step = 1;
+        while (step * 2 <= n_)
+            step *= 2;
+        for (; step > 0; step /= 2) {
+            if (pos + step <= n_ && tree_[pos + step] <= target) {
+                pos += step;
+                target -= tree_[pos];
+            }
+        }
+        // rounding may push pos beyond the last column of positive weight
+        j = (pos < n_)? pos: n_ - 1;
+    }
+    prob = mix / n_ + ((total_ > 0.0)? 
+            (1.0 - mix) * weights_[j] / total_: 0.0);
+    if (prob <= 0.0)
+        prob = 1.0 / n_;
+    return j;
+}
+} // namespace NMF
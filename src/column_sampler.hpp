@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <mutex>
+
+namespace NMF {
+
+// Sample column ids with probability proportional to nonnegative weights,
+// mixed with the uniform distribution so that every column keeps a positive
+// probability. Weights are kept in a Fenwick tree, so that both updating a 
+// weight and sampling take O(log n).
+class ColumnSampler {
+    public:
+        ColumnSampler();
+
+        // Init sampler over n columns with given weights, a column is sampled
+        // uniformly with probability uniform_mix and proportionally to its 
+        // weight otherwise
+        void Init(const std::vector<double> & weights, double uniform_mix);
+        bool IsInit();
+
+        // Set weight of column j
+        void SetWeight(int j, double weight);
+        // Sample a column j and get its probability of being sampled
+        int Sample(double & prob);
+
+    private:
+        // Add inc to weight of column j, requires mtx_ to be held
+        void AddWeight(int j, double inc);
+
+    private:
+        int n_;
+        double uniform_mix_;
+        // weights_[j] is weight of column j, tree_ is the Fenwick tree over 
+        // weights_ indexed from 1
+        std::vector<double> weights_, tree_;
+        double total_;
+        // mutex prevents contension
+        std::mutex mtx_;
+};
+}; // namespace NMF
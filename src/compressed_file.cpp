@@ -0,0 +1,283 @@
+#include "compressed_file.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glog/logging.h>
+#ifdef NMF_USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef NMF_USE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace NMF {
+
+namespace {
+    const unsigned char kGzipMagic[2] = {0x1F, 0x8B};
+    const unsigned char kZstdMagic[4] = {0x28, 0xB5, 0x2F, 0xFD};
+
+    // Source of decompressed bytes behind a FILE *
+    class DecompressStream {
+        public:
+            virtual ~DecompressStream() {}
+            // Read up to size bytes, returns 0 at the end of file
+            virtual ssize_t Read(char * buf, size_t size) = 0;
+    };
+
+    ssize_t CookieRead(void * cookie, char * buf, size_t size) {
+        return ((DecompressStream *)cookie)->Read(buf, size);
+    }
+
+    int CookieClose(void * cookie) {
+        delete (DecompressStream *)cookie;
+        return 0;
+    }
+
+#ifdef NMF_USE_ZLIB
+    // Members of gzip files cannot be located without inflating them, so 
+    // they are decompressed in order by the reader
+    class GzipStream: public DecompressStream {
+        public:
+            GzipStream(std::string file): file_(file) {
+                CHECK((gz_ = gzopen(file.c_str(), "rb")) != NULL) 
+                    << "Fails to open " << file;
+                gzbuffer(gz_, 1 << 20);
+            }
+            ~GzipStream() {
+                gzclose(gz_);
+            }
+            ssize_t Read(char * buf, size_t size) {
+                int bytes = gzread(gz_, buf, 
+                        (unsigned)std::min(size, size_t(1) << 30));
+                CHECK_GE(bytes, 0) << "Fails to decompress " << file_;
+                return bytes;
+            }
+
+        private:
+            std::string file_;
+            gzFile gz_;
+    };
+#endif
+
+#ifdef NMF_USE_ZSTD
+    // Frames of a zstd file are located from their headers in the mapped 
+    // file. A single frame is decompressed in order by the reader, multiple
+    // frames are decompressed by worker threads up to 2 frames per thread 
+    // ahead of the reader
+    class ZstdStream: public DecompressStream {
+        public:
+            ZstdStream(std::string file, int num_threads);
+            ~ZstdStream();
+            ssize_t Read(char * buf, size_t size);
+
+        private:
+            // Decompress a whole frame
+            void DecompressFrame(int frame, std::vector<char> & out);
+            // Decompress frames in turn until stopped
+            void WorkerLoop();
+
+            std::string file_;
+            const char * addr_;
+            size_t bytes_;
+            // offset and compressed size of each frame
+            std::vector<std::pair<size_t, size_t> > frames_;
+            // stream and input of decompression by the reader
+            ZSTD_DStream * dstream_;
+            ZSTD_inBuffer input_;
+            // decompression by workers, where frames decompressed ahead are 
+            // kept in done_ until the reader takes them
+            std::vector<std::thread> workers_;
+            std::mutex mtx_;
+            std::condition_variable cv_;
+            std::map<int, std::vector<char> > done_;
+            int next_frame_, read_frame_, max_ahead_;
+            bool stop_;
+            // frame being read and the read position in it
+            std::vector<char> current_;
+            size_t current_pos_;
+    };
+
+    ZstdStream::ZstdStream(std::string file, int num_threads): file_(file), 
+        dstream_(NULL), next_frame_(0), read_frame_(0), 
+        max_ahead_(2 * num_threads), stop_(false), current_pos_(0) {
+        int fd = open(file.c_str(), O_RDONLY);
+        CHECK_GE(fd, 0) << "Fails to open " << file;
+        struct stat st;
+        CHECK_EQ(fstat(fd, &st), 0) << "Fails to stat " << file;
+        bytes_ = st.st_size;
+        void * addr = mmap(NULL, bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+        CHECK(addr != MAP_FAILED) << "Fails to map " << file;
+        close(fd);
+        addr_ = (const char *)addr;
+        madvise(addr, bytes_, MADV_SEQUENTIAL);
+        for (size_t pos = 0; pos < bytes_; ) {
+            size_t frame_bytes = 
+                ZSTD_findFrameCompressedSize(addr_ + pos, bytes_ - pos);
+            CHECK(!ZSTD_isError(frame_bytes)) << "Corrupted frame at byte " 
+                << pos << " of " << file << ": " 
+                << ZSTD_getErrorName(frame_bytes);
+            frames_.push_back(std::make_pair(pos, frame_bytes));
+            pos += frame_bytes;
+        }
+        if (num_threads <= 1 || frames_.size() <= 1) {
+            dstream_ = ZSTD_createDStream();
+            ZSTD_initDStream(dstream_);
+            input_.src = addr_;
+            input_.size = bytes_;
+            input_.pos = 0;
+            return;
+        }
+        LOG(INFO) << "decompressing " << frames_.size() << " frames of " 
+            << file << " by " << num_threads << " threads";
+        for (int t = 0; t < num_threads; ++t) {
+            workers_.push_back(std::thread(&ZstdStream::WorkerLoop, this));
+        }
+    }
+
+    ZstdStream::~ZstdStream() {
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto & thr: workers_) {
+            thr.join();
+        }
+        if (dstream_ != NULL)
+            ZSTD_freeDStream(dstream_);
+        munmap((void *)addr_, bytes_);
+    }
+
+    void ZstdStream::DecompressFrame(int frame, std::vector<char> & out) {
+        const char * src = addr_ + frames_[frame].first;
+        ZSTD_inBuffer input = {src, frames_[frame].second, 0};
+        unsigned long long content_size = 
+            ZSTD_getFrameContentSize(src, frames_[frame].second);
+        out.clear();
+        if (content_size != ZSTD_CONTENTSIZE_UNKNOWN 
+                && content_size != ZSTD_CONTENTSIZE_ERROR)
+            out.reserve(content_size);
+        ZSTD_DStream * dstream = ZSTD_createDStream();
+        ZSTD_initDStream(dstream);
+        std::vector<char> chunk(ZSTD_DStreamOutSize());
+        size_t ret;
+        do {
+            ZSTD_outBuffer output = {chunk.data(), chunk.size(), 0};
+            ret = ZSTD_decompressStream(dstream, &output, &input);
+            CHECK(!ZSTD_isError(ret)) << "Fails to decompress frame " 
+                << frame << " of " << file_ << ": " 
+                << ZSTD_getErrorName(ret);
+            CHECK(output.pos > 0 || input.pos < input.size || ret == 0) 
+                << "Truncated frame " << frame << " of " << file_;
+            out.insert(out.end(), chunk.data(), chunk.data() + output.pos);
+        } while (ret != 0);
+        ZSTD_freeDStream(dstream);
+    }
+
+    void ZstdStream::WorkerLoop() {
+        while (true) {
+            int frame;
+            {
+                std::unique_lock<std::mutex> lck(mtx_);
+                cv_.wait(lck, [this] { return stop_ || (next_frame_ < 
+                            (int)frames_.size() && next_frame_ < read_frame_
+                            + max_ahead_); });
+                if (stop_)
+                    return;
+                frame = next_frame_++;
+            }
+            std::vector<char> out;
+            DecompressFrame(frame, out);
+            {
+                std::unique_lock<std::mutex> lck(mtx_);
+                done_[frame].swap(out);
+            }
+            cv_.notify_all();
+        }
+    }
+
+    ssize_t ZstdStream::Read(char * buf, size_t size) {
+        if (dstream_ != NULL) {
+            ZSTD_outBuffer output = {buf, size, 0};
+            while (output.pos == 0 && input_.pos < input_.size) {
+                size_t ret = ZSTD_decompressStream(dstream_, &output, &input_);
+                CHECK(!ZSTD_isError(ret)) << "Fails to decompress " << file_
+                    << ": " << ZSTD_getErrorName(ret);
+            }
+            return output.pos;
+        }
+        size_t copied = 0;
+        while (copied < size) {
+            if (current_pos_ == current_.size()) {
+                if (read_frame_ == (int)frames_.size())
+                    break;
+                {
+                    std::unique_lock<std::mutex> lck(mtx_);
+                    cv_.wait(lck, [this] { 
+                            return done_.count(read_frame_) > 0; });
+                    current_.swap(done_[read_frame_]);
+                    done_.erase(read_frame_);
+                    ++read_frame_;
+                }
+                cv_.notify_all();
+                current_pos_ = 0;
+                continue;
+            }
+            size_t bytes = std::min(size - copied, 
+                    current_.size() - current_pos_);
+            memcpy(buf + copied, current_.data() + current_pos_, bytes);
+            copied += bytes;
+            current_pos_ += bytes;
+        }
+        return copied;
+    }
+#endif
+} // anonymous namespace
+
+// Open data file, decompressing it if needed
+FILE * OpenDataFile(std::string data_file, int num_threads) {
+    FILE * fp = fopen(data_file.c_str(), "rb");
+    CHECK(fp != NULL) << "Fails to open " << data_file;
+    unsigned char magic[4];
+    size_t magic_bytes = fread(magic, 1, sizeof(magic), fp);
+    DecompressStream * stream = NULL;
+    if (magic_bytes >= sizeof(kGzipMagic) 
+            && memcmp(magic, kGzipMagic, sizeof(kGzipMagic)) == 0) {
+#ifdef NMF_USE_ZLIB
+        stream = new GzipStream(data_file);
+#else
+        LOG(FATAL) << data_file << " is compressed by gzip, which requires "
+            "building with NMF_USE_ZLIB";
+#endif
+    } else if (magic_bytes >= sizeof(kZstdMagic) 
+            && memcmp(magic, kZstdMagic, sizeof(kZstdMagic)) == 0) {
+#ifdef NMF_USE_ZSTD
+        stream = new ZstdStream(data_file, num_threads);
+#else
+        LOG(FATAL) << data_file << " is compressed by zstd, which requires "
+            "building with NMF_USE_ZSTD";
+#endif
+    }
+    if (stream == NULL) {
+        rewind(fp);
+        return fp;
+    }
+    fclose(fp);
+    cookie_io_functions_t io_functions = {CookieRead, NULL, NULL, 
+        CookieClose};
+    CHECK((fp = fopencookie(stream, "r", io_functions)) != NULL) 
+        << "Fails to open " << data_file;
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+    return fp;
+}
+} // namespace NMF
@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+#include <cstdio>
+
+// Reading of data files that may be compressed. Files compressed by gzip
+// (if built with NMF_USE_ZLIB) or zstd (if built with NMF_USE_ZSTD) are
+// detected by their magic bytes and decompressed as they are read, so that
+// the text and binary parsers of MatrixLoader consume them through a plain
+// FILE *. Frames of zstd files with multiple frames, as written by pzstd or
+// by concatenating compressed files, are decompressed in parallel ahead of
+// the reader
+namespace NMF {
+
+// Open data_file for reading, decompressing it by up to num_threads
+// threads if it is compressed. The result is closed by fclose
+FILE * OpenDataFile(std::string data_file, int num_threads = 1);
+}; // namespace NMF
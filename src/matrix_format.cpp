@@ -0,0 +1,467 @@
+#include "matrix_format.hpp"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glog/logging.h>
+
+namespace NMF {
+
+namespace {
+    const char kMagic[8] = {'N', 'M', 'F', 'M', 'A', 'T', 0, 0};
+    const uint32_t kVersion = 1;
+
+    // Table of the reflected CRC-32 polynomial 0xEDB88320
+    struct Crc32Table {
+        uint32_t entries[256];
+        Crc32Table() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1)? 0xEDB88320 ^ (c >> 1): c >> 1;
+                }
+                entries[i] = c;
+            }
+        }
+    };
+
+    const char kNpyMagic[6] = {'\x93', 'N', 'U', 'M', 'P', 'Y'};
+
+    // Copy columns col_begin to col_end - 1 of a rows-by-cols array to 
+    // cols in column-major order. Arrays in C order are copied by tiles of
+    // kTile-by-kTile elements so that both sides are accessed in lines
+    template <class S>
+    void CopyNpyCols(const S * data, long rows, long cols, bool fortran_order,
+            long col_begin, long col_end, float * out) {
+        if (fortran_order) {
+            const S * src = data + col_begin * rows;
+            std::copy(src, src + (col_end - col_begin) * rows, out);
+            return;
+        }
+        const long kTile = 64;
+        for (long i0 = 0; i0 < rows; i0 += kTile) {
+            long i1 = std::min(rows, i0 + kTile);
+            for (long j0 = col_begin; j0 < col_end; j0 += kTile) {
+                long j1 = std::min(col_end, j0 + kTile);
+                for (long i = i0; i < i1; ++i) {
+                    const S * src = data + i * cols;
+                    for (long j = j0; j < j1; ++j) {
+                        out[(j - col_begin) * rows + i] = src[j];
+                    }
+                }
+            }
+        }
+    }
+
+    // Value of key in the dictionary of an .npy header, up to the next 
+    // comma outside parentheses
+    std::string NpyHeaderValue(const std::string & header, 
+            const std::string & key, const std::string & file) {
+        size_t pos = header.find("'" + key + "'");
+        CHECK(pos != std::string::npos) << "Missing " << key 
+            << " in header of " << file;
+        pos = header.find(':', pos) + 1;
+        size_t end = pos;
+        int depth = 0;
+        while (end < header.size() && (depth > 0 || (header[end] != ',' 
+                        && header[end] != '}'))) {
+            if (header[end] == '(')
+                ++depth;
+            else if (header[end] == ')')
+                --depth;
+            ++end;
+        }
+        std::string value = header.substr(pos, end - pos);
+        value.erase(0, value.find_first_not_of(" "));
+        value.erase(value.find_last_not_of(" ") + 1);
+        return value;
+    }
+} // anonymous namespace
+
+// CRC-32 of data
+uint32_t Crc32(const void * data, size_t bytes, uint32_t crc) {
+    static const Crc32Table table;
+    const unsigned char * p = (const unsigned char *)data;
+    crc = ~crc;
+    for (size_t i = 0; i < bytes; ++i) {
+        crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Check magic of file
+bool IsMatrixFile(std::string file) {
+    char magic[sizeof(kMagic)];
+    FILE * fp = fopen(file.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+    bool is_matrix_file = (fread(magic, 1, sizeof(magic), fp) ==
+            sizeof(magic) && memcmp(magic, kMagic, sizeof(magic)) == 0);
+    fclose(fp);
+    return is_matrix_file;
+}
+
+// Constructor
+MatrixFileReader::MatrixFileReader(): addr_(NULL), bytes_(0) {
+}
+
+// Deconstructor
+MatrixFileReader::~MatrixFileReader() {
+    if (addr_ != NULL)
+        munmap(addr_, bytes_);
+}
+
+// Map file and read its header and index
+void MatrixFileReader::Open(std::string file) {
+    file_ = file;
+    int fd = open(file.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "Fails to open " << file;
+    struct stat st;
+    CHECK_EQ(fstat(fd, &st), 0) << "Fails to stat " << file;
+    bytes_ = st.st_size;
+    CHECK_GE(bytes_, sizeof(MatrixFileHeader)) << file
+        << " is not a matrix file";
+    addr_ = mmap(NULL, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+    CHECK(addr_ != MAP_FAILED) << "Fails to map " << file;
+    close(fd);
+
+    memcpy(&header_, addr_, sizeof(header_));
+    CHECK(memcmp(header_.magic, kMagic, sizeof(kMagic)) == 0) << file
+        << " is not a matrix file";
+    CHECK_EQ(header_.version, kVersion) << "Unsupported version of " << file;
+    CHECK_EQ(header_.dtype, uint32_t(kFloat32)) << "Unsupported element type "
+        << header_.dtype << " of " << file;
+    CHECK_EQ(header_.layout, kColMajor) << "Unsupported layout of " << file;
+    CHECK(header_.chunk_cols > 0 && header_.num_chunks ==
+            (header_.cols + header_.chunk_cols - 1) / header_.chunk_cols)
+        << "Corrupted header of " << file;
+    size_t index_bytes = header_.num_chunks * sizeof(MatrixChunkEntry);
+    CHECK_GE(bytes_, sizeof(header_) + index_bytes) << "Truncated index of "
+        << file;
+    index_.resize(header_.num_chunks);
+    memcpy(index_.data(), (char *)addr_ + sizeof(header_), index_bytes);
+    for (long c = 0; c < (long)index_.size(); ++c) {
+        long cols = std::min<long>(header_.chunk_cols,
+                header_.cols - c * header_.chunk_cols);
+        CHECK(index_[c].offset + index_[c].bytes <= bytes_ &&
+                index_[c].bytes == cols * header_.rows * sizeof(float))
+            << "Chunk " << c << " of " << file << " is truncated";
+    }
+}
+
+// Get statistics of matrix
+long MatrixFileReader::GetRows() {
+    return header_.rows;
+}
+
+long MatrixFileReader::GetCols() {
+    return header_.cols;
+}
+
+long MatrixFileReader::GetChunkCols() {
+    return header_.chunk_cols;
+}
+
+long MatrixFileReader::GetNumChunks() {
+    return header_.num_chunks;
+}
+
+// Verify and decode a chunk
+int MatrixFileReader::ReadChunk(long chunk, std::vector<float> & data) {
+    CHECK(chunk >= 0 && chunk < (long)index_.size()) << "Chunk " << chunk
+        << " out of range of " << file_;
+    const MatrixChunkEntry & entry = index_[chunk];
+    const char * src = (const char *)addr_ + entry.offset;
+    CHECK_EQ(Crc32(src, entry.bytes), entry.checksum) << "Checksum of chunk "
+        << chunk << " of " << file_ << " mismatches";
+    data.resize(entry.bytes / sizeof(float));
+    memcpy(data.data(), src, entry.bytes);
+    return data.size() / header_.rows;
+}
+
+// Constructor
+MatrixFileWriter::MatrixFileWriter(): fp_(NULL), num_appended_(0) {
+}
+
+// Deconstructor
+MatrixFileWriter::~MatrixFileWriter() {
+    if (fp_ != NULL)
+        fclose(fp_);
+}
+
+// Create file and reserve its header and index
+void MatrixFileWriter::Open(std::string file, long rows, long cols,
+        long chunk_cols) {
+    CHECK_GT(rows, 0) << "Matrix must have rows";
+    file_ = file;
+    CHECK((fp_ = fopen(file.c_str(), "wb")) != NULL) << "Fails to open "
+        << file;
+    if (chunk_cols <= 0)
+        chunk_cols = std::max(1L, (1L << 20) / long(rows * sizeof(float)));
+    memset(&header_, 0, sizeof(header_));
+    memcpy(header_.magic, kMagic, sizeof(kMagic));
+    header_.version = kVersion;
+    header_.dtype = kFloat32;
+    header_.layout = kColMajor;
+    header_.rows = rows;
+    header_.cols = cols;
+    header_.chunk_cols = chunk_cols;
+    header_.num_chunks = (cols + chunk_cols - 1) / chunk_cols;
+    index_.assign(header_.num_chunks, MatrixChunkEntry());
+    memset(index_.data(), 0, index_.size() * sizeof(MatrixChunkEntry));
+    fwrite(&header_, sizeof(header_), 1, fp_);
+    fwrite(index_.data(), sizeof(MatrixChunkEntry), index_.size(), fp_);
+    chunk_.clear();
+    num_appended_ = 0;
+}
+
+// Append a column
+void MatrixFileWriter::AppendCol(const float * col) {
+    CHECK_LT(num_appended_, (long)header_.cols) << "Too many columns for "
+        << file_;
+    chunk_.insert(chunk_.end(), col, col + header_.rows);
+    ++num_appended_;
+    if (num_appended_ % header_.chunk_cols == 0)
+        FlushChunk();
+}
+
+// Write buffered columns
+void MatrixFileWriter::FlushChunk() {
+    if (chunk_.empty())
+        return;
+    long chunk = (num_appended_ - 1) / header_.chunk_cols;
+    MatrixChunkEntry & entry = index_[chunk];
+    entry.offset = ftell(fp_);
+    entry.bytes = chunk_.size() * sizeof(float);
+    entry.checksum = Crc32(chunk_.data(), entry.bytes);
+    CHECK_EQ(fwrite(chunk_.data(), sizeof(float), chunk_.size(), fp_),
+            chunk_.size()) << "Fails to write " << file_;
+    chunk_.clear();
+}
+
+// Finish file
+void MatrixFileWriter::Close() {
+    CHECK_EQ(num_appended_, (long)header_.cols) << "Missing columns of "
+        << file_;
+    FlushChunk();
+    fseek(fp_, sizeof(header_), SEEK_SET);
+    fwrite(index_.data(), sizeof(MatrixChunkEntry), index_.size(), fp_);
+    fclose(fp_);
+    fp_ = NULL;
+}
+// Constructor
+NpyFileReader::NpyFileReader(): addr_(NULL), bytes_(0) {
+}
+
+// Deconstructor
+NpyFileReader::~NpyFileReader() {
+    if (addr_ != NULL)
+        munmap(addr_, bytes_);
+}
+
+// Map file and parse its header
+void NpyFileReader::Open(std::string file) {
+    file_ = file;
+    int fd = open(file.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "Fails to open " << file;
+    struct stat st;
+    CHECK_EQ(fstat(fd, &st), 0) << "Fails to stat " << file;
+    bytes_ = st.st_size;
+    CHECK_GE(bytes_, size_t(12)) << file << " is not an .npy file";
+    addr_ = mmap(NULL, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+    CHECK(addr_ != MAP_FAILED) << "Fails to map " << file;
+    close(fd);
+
+    // Version 1 has a 2-byte header length, later versions 4 bytes
+    const unsigned char * p = (const unsigned char *)addr_;
+    CHECK(memcmp(p, kNpyMagic, sizeof(kNpyMagic)) == 0) << file 
+        << " is not an .npy file";
+    size_t header_len;
+    if (p[6] == 1) {
+        header_len = p[8] | (p[9] << 8);
+        data_offset_ = 10 + header_len;
+    } else {
+        header_len = p[8] | (p[9] << 8) | (p[10] << 16) | (size_t(p[11]) << 24);
+        data_offset_ = 12 + header_len;
+    }
+    CHECK_LE(data_offset_, bytes_) << "Truncated header of " << file;
+    std::string header((const char *)p + data_offset_ - header_len, 
+            header_len);
+
+    std::string descr = NpyHeaderValue(header, "descr", file);
+    if (descr == "'<f4'") {
+        item_size_ = 4;
+    } else if (descr == "'<f8'") {
+        item_size_ = 8;
+    } else {
+        LOG(FATAL) << "Unsupported dtype " << descr << " of " << file 
+            << ", only little-endian float32 and float64 are supported";
+    }
+    fortran_order_ = (NpyHeaderValue(header, "fortran_order", file) == "True");
+    std::string shape = NpyHeaderValue(header, "shape", file);
+    CHECK_EQ(sscanf(shape.c_str(), "(%ld, %ld)", &rows_, &cols_), 2) 
+        << "Shape " << shape << " of " << file << " is not 2-D";
+    CHECK_GE(bytes_, data_offset_ + size_t(rows_) * cols_ * item_size_) 
+        << "Truncated data of " << file;
+}
+
+// Get statistics of array
+long NpyFileReader::GetRows() {
+    return rows_;
+}
+
+long NpyFileReader::GetCols() {
+    return cols_;
+}
+
+int NpyFileReader::GetItemSize() {
+    return item_size_;
+}
+
+bool NpyFileReader::IsFortranOrder() {
+    return fortran_order_;
+}
+
+size_t NpyFileReader::GetDataOffset() {
+    return data_offset_;
+}
+
+// Copy columns as float
+void NpyFileReader::ReadCols(long col_begin, long col_end, float * cols) {
+    CHECK(col_begin >= 0 && col_begin <= col_end && col_end <= cols_) 
+        << "Columns " << col_begin << " to " << col_end - 1 
+        << " out of range of " << file_;
+    const char * data = (const char *)addr_ + data_offset_;
+    if (item_size_ == 4) {
+        CopyNpyCols((const float *)data, rows_, cols_, fortran_order_, 
+                col_begin, col_end, cols);
+    } else {
+        CopyNpyCols((const double *)data, rows_, cols_, fortran_order_, 
+                col_begin, col_end, cols);
+    }
+}
+
+// Constructor
+NpyFileWriter::NpyFileWriter(): fp_(NULL), num_appended_(0) {
+}
+
+// Deconstructor
+NpyFileWriter::~NpyFileWriter() {
+    if (fp_ != NULL)
+        fclose(fp_);
+}
+
+// Create file and write header of version 1
+void NpyFileWriter::Open(std::string file, long rows, long cols) {
+    file_ = file;
+    rows_ = rows;
+    cols_ = cols;
+    num_appended_ = 0;
+    CHECK((fp_ = fopen(file.c_str(), "wb")) != NULL) << "Fails to open "
+        << file;
+    std::string header = "{'descr': '<f4', 'fortran_order': True, "
+        "'shape': (" + std::to_string(rows) + ", " + std::to_string(cols) 
+        + "), }";
+    // Elements start at a multiple of 64 bytes, the header ends with '\n'
+    header.append(63 - (10 + header.size()) % 64, ' ');
+    header.push_back('\n');
+    unsigned char preamble[10];
+    memcpy(preamble, kNpyMagic, sizeof(kNpyMagic));
+    preamble[6] = 1;
+    preamble[7] = 0;
+    preamble[8] = header.size() & 0xFF;
+    preamble[9] = header.size() >> 8;
+    fwrite(preamble, 1, sizeof(preamble), fp_);
+    fwrite(header.data(), 1, header.size(), fp_);
+}
+
+// Append a column
+void NpyFileWriter::AppendCol(const float * col) {
+    CHECK_LT(num_appended_, cols_) << "Too many columns for " << file_;
+    CHECK_EQ(fwrite(col, sizeof(float), rows_, fp_), size_t(rows_)) 
+        << "Fails to write " << file_;
+    ++num_appended_;
+}
+
+// Finish file
+void NpyFileWriter::Close() {
+    CHECK_EQ(num_appended_, cols_) << "Missing columns of " << file_;
+    fclose(fp_);
+    fp_ = NULL;
+}
+
+// Check for a directory of shards
+bool IsShardDirectory(std::string data_file) {
+    struct stat st;
+    return stat(data_file.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Read manifest of shards
+void ReadShardManifest(std::string data_dir, long & rows, long & cols, 
+        std::vector<MatrixShard> & shards) {
+    std::string manifest = data_dir + "/manifest";
+    std::ifstream fin(manifest.c_str());
+    CHECK(fin.is_open()) << "Fails to open " << manifest;
+    std::string line;
+    bool has_shape = false;
+    shards.clear();
+    while (std::getline(fin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos 
+                || line[line.find_first_not_of(" \t")] == '#')
+            continue;
+        std::istringstream sin(line);
+        if (!has_shape) {
+            CHECK(sin >> rows >> cols) << "Missing shape in " << manifest;
+            has_shape = true;
+            continue;
+        }
+        MatrixShard shard;
+        CHECK(sin >> shard.file >> shard.first_col >> shard.num_cols) 
+            << "Malformed line in " << manifest << ": " << line;
+        shard.file = data_dir + "/" + shard.file;
+        shards.push_back(shard);
+    }
+    CHECK(has_shape) << "Missing shape in " << manifest;
+    std::sort(shards.begin(), shards.end(), 
+            [](const MatrixShard & a, const MatrixShard & b) { 
+            return a.first_col < b.first_col; });
+    long next_col = 0;
+    for (const MatrixShard & shard: shards) {
+        CHECK(shard.first_col == next_col && shard.num_cols >= 0) 
+            << "Shards of " << manifest << " do not hold column " 
+            << next_col << " exactly once";
+        next_col += shard.num_cols;
+    }
+    CHECK_EQ(next_col, cols) << "Shards of " << manifest 
+        << " do not hold all columns";
+}
+
+// Get shape of matrix file
+void GetMatrixFileShape(std::string file, std::string data_format, 
+        long & rows, long & cols) {
+    if (IsShardDirectory(file)) {
+        std::vector<MatrixShard> shards;
+        ReadShardManifest(file, rows, cols, shards);
+    } else if (data_format == "nmf") {
+        MatrixFileReader reader;
+        reader.Open(file);
+        rows = reader.GetRows();
+        cols = reader.GetCols();
+    } else if (data_format == "npy") {
+        NpyFileReader reader;
+        reader.Open(file);
+        rows = reader.GetRows();
+        cols = reader.GetCols();
+    } else {
+        LOG(FATAL) << "Format " << data_format << " has no header";
+    }
+}
+} // namespace NMF
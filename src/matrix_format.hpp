@@ -0,0 +1,187 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+// Self-describing binary matrix format "nmf". A file starts with a header
+// holding the dimensions, element type and layout of the matrix, followed by
+// an index of chunks and the chunks themselves. Columns are stored in
+// column-major order in chunks of chunk_cols consecutive columns, the last
+// chunk holding the remaining columns. Each entry of the index holds the
+// byte offset of a chunk in the file, its size in bytes and the CRC-32 of
+// its bytes, so that any column can be sought and verified on its own. All
+// fields are little-endian
+namespace NMF {
+
+// Element types of matrix files
+enum MatrixDtype {
+    kFloat32 = 0
+};
+
+// Column-major layout, the only one supported so far
+const uint32_t kColMajor = 0;
+
+struct MatrixFileHeader {
+    // "NMFMAT" padded with zeros
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t layout;
+    uint32_t reserved;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t chunk_cols;
+    uint64_t num_chunks;
+};
+
+struct MatrixChunkEntry {
+    uint64_t offset;
+    uint64_t bytes;
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+// CRC-32 of bytes of data, continuing from crc
+uint32_t Crc32(const void * data, size_t bytes, uint32_t crc = 0);
+
+// Whether file starts with the magic of the format
+bool IsMatrixFile(std::string file);
+
+class MatrixFileReader {
+    public:
+        MatrixFileReader();
+        ~MatrixFileReader();
+
+        // Map file and validate its header and chunk index
+        void Open(std::string file);
+
+        /* Get statistics of matrix */
+        long GetRows();
+        long GetCols();
+        long GetChunkCols();
+        long GetNumChunks();
+
+        // Decode chunk into data of GetRows() elements per column after
+        // verifying its checksum. Columns of the chunk start at column
+        // chunk * GetChunkCols(). Returns the number of columns of the chunk.
+        // Chunks may be read by multiple threads at once
+        int ReadChunk(long chunk, std::vector<float> & data);
+
+    private:
+        std::string file_;
+        MatrixFileHeader header_;
+        std::vector<MatrixChunkEntry> index_;
+        // mapping of the whole file
+        void * addr_;
+        size_t bytes_;
+};
+
+class MatrixFileWriter {
+    public:
+        MatrixFileWriter();
+        ~MatrixFileWriter();
+
+        // Create file for a rows-by-cols matrix in chunks of chunk_cols
+        // columns, where 0 picks chunks of about 1MB
+        void Open(std::string file, long rows, long cols, long chunk_cols = 0);
+
+        // Append the next column of rows elements
+        void AppendCol(const float * col);
+
+        // Write the last chunk and the chunk index, all columns must have
+        // been appended
+        void Close();
+
+    private:
+        // Write the buffered columns as a chunk
+        void FlushChunk();
+
+        std::string file_;
+        FILE * fp_;
+        MatrixFileHeader header_;
+        std::vector<MatrixChunkEntry> index_;
+        // columns of the current chunk and the number of appended columns
+        std::vector<float> chunk_;
+        long num_appended_;
+};
+// Reader of 2-D NumPy .npy files of float32 or float64 in C or Fortran 
+// order, whose shape is taken as rows-by-cols
+class NpyFileReader {
+    public:
+        NpyFileReader();
+        ~NpyFileReader();
+
+        // Map file and parse its header
+        void Open(std::string file);
+
+        /* Get statistics of array */
+        long GetRows();
+        long GetCols();
+        // Size of elements in bytes, 4 for float32 and 8 for float64
+        int GetItemSize();
+        bool IsFortranOrder();
+        // Offset of the elements in the file
+        size_t GetDataOffset();
+
+        // Copy columns col_begin to col_end - 1 as float to cols in 
+        // column-major order, transposing arrays in C order by tiles. 
+        // Columns may be read by multiple threads at once
+        void ReadCols(long col_begin, long col_end, float * cols);
+
+    private:
+        std::string file_;
+        long rows_, cols_;
+        int item_size_;
+        bool fortran_order_;
+        size_t data_offset_;
+        // mapping of the whole file
+        void * addr_;
+        size_t bytes_;
+};
+
+class NpyFileWriter {
+    public:
+        NpyFileWriter();
+        ~NpyFileWriter();
+
+        // Create file for a rows-by-cols float32 array in Fortran order
+        void Open(std::string file, long rows, long cols);
+
+        // Append the next column of rows elements
+        void AppendCol(const float * col);
+
+        // Close file, all columns must have been appended
+        void Close();
+
+    private:
+        std::string file_;
+        FILE * fp_;
+        long rows_, cols_, num_appended_;
+};
+
+// Shard of a matrix split by columns. A directory of shards holds a text 
+// file "manifest", whose first line is "rows cols" of the matrix, followed 
+// by a line "file first_col num_cols" per shard, where file is relative to
+// the directory and holds columns first_col to first_col + num_cols - 1 of 
+// the matrix in one of the dense formats. Empty lines and lines starting 
+// with '#' are skipped
+struct MatrixShard {
+    std::string file;
+    long first_col, num_cols;
+};
+
+// Whether data_file is a directory of shards
+bool IsShardDirectory(std::string data_file);
+
+// Read the manifest of a directory of shards, where shards are sorted by 
+// column and must hold each column exactly once. File names of shards are
+// prefixed by the directory
+void ReadShardManifest(std::string data_dir, long & rows, long & cols, 
+        std::vector<MatrixShard> & shards);
+
+// Get the shape of a matrix file in data_format "nmf" or "npy", or of a 
+// directory of shards
+void GetMatrixFileShape(std::string file, std::string data_format, 
+        long & rows, long & cols);
+}; // namespace NMF
@@ -1,38 +1,234 @@
 #include "matrix_loader.hpp"
+#include "matrix_format.hpp"
+#include "compressed_file.hpp"
 
 #include <string>
 #include <vector>
 #include <cstdio>
 #include <mutex>
 #include <iostream>
+#include <limits>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <queue>
+#include <fstream>
+#include <memory>
+#include <streambuf>
+#include <functional>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <glog/logging.h>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
 
 namespace NMF {
 
+// Conversion of elements between float and reduced precision. Narrowing 
+// rounds to nearest even, and widening loops are kept simple so that they 
+// are vectorized, using the F16C instructions for fp16 if available
+static inline uint16_t FloatToHalf(float value) {
+    const uint32_t f32_infty = 255u << 23, f16_max = (127u + 16) << 23;
+    const uint32_t denorm_magic_bits = ((127u - 15) + (23 - 10) + 1) << 23;
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+    uint16_t h;
+    if (f >= f16_max) {
+        // overflow to infinity, NaN stays NaN
+        h = (f > f32_infty)? 0x7E00: 0x7C00;
+    } else if (f < (113u << 23)) {
+        // subnormal, rounded by the addition of a magic number
+        float denorm_magic, x;
+        memcpy(&denorm_magic, &denorm_magic_bits, sizeof(float));
+        memcpy(&x, &f, sizeof(float));
+        x += denorm_magic;
+        memcpy(&f, &x, sizeof(float));
+        h = f - denorm_magic_bits;
+    } else {
+        uint32_t mant_odd = (f >> 13) & 1;
+        f += ((uint32_t)(15 - 127) << 23) + 0xFFF + mant_odd;
+        h = f >> 13;
+    }
+    return h | (sign >> 16);
+}
+
+static inline float HalfToFloat(uint16_t h) {
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F, mant = h & 0x3FF;
+    uint32_t f;
+    if (exp == 0) {
+        float x = std::ldexp(float(mant), -24);
+        memcpy(&f, &x, sizeof(f));
+        f |= sign;
+    } else if (exp == 31) {
+        f = sign | 0x7F800000u | (mant << 13);
+    } else {
+        f = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float value;
+    memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
+static inline uint16_t FloatToBFloat(float value) {
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    if ((f & 0x7FFFFFFFu) > 0x7F800000u)
+        return (f >> 16) | 0x40;
+    f += 0x7FFF + ((f >> 16) & 1);
+    return f >> 16;
+}
+
+static void WidenHalf(const uint16_t * src, int n, float * dst) {
+    int i = 0;
+#ifdef __F16C__
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(
+                    _mm_loadu_si128((const __m128i *)(src + i))));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = HalfToFloat(src[i]);
+    }
+}
+
+static void WidenBFloat(const uint16_t * src, int n, float * dst) {
+    uint32_t * bits = (uint32_t *)dst;
+    for (int i = 0; i < n; ++i) {
+        bits[i] = uint32_t(src[i]) << 16;
+    }
+}
+
+static void WidenInt8(const int8_t * src, int n, float scale, float * dst) {
+    for (int i = 0; i < n; ++i) {
+        dst[i] = scale * src[i];
+    }
+}
+
 // Constructor
 template <class T>
-MatrixLoader<T>::MatrixLoader() {
+MatrixLoader<T>::MatrixLoader(): sparse_density_(0.0), precision_(kFP32), 
+    quant_error_(0.0), mapped_(NULL), 
+    map_addr_(NULL), map_bytes_(0), converged_tol_(0.0), 
+    converged_prob_(1.0), out_of_core_(false), cache_fp_(NULL), 
+    cache_fd_(-1), block_clock_(0), next_cycle_block_(0), num_sampled_(0), 
+    io_stop_(false) {
     srand((unsigned)time(NULL));
 }
 
 // Deconstructor
 template <class T>
 MatrixLoader<T>::~MatrixLoader() {
+    if (io_thread_.joinable()) {
+        {
+            std::unique_lock<std::mutex> lck(block_mtx_);
+            io_stop_ = true;
+        }
+        block_cv_.notify_all();
+        io_thread_.join();
+    }
+    if (cache_fd_ >= 0)
+        close(cache_fd_);
+    if (map_addr_ != NULL)
+        munmap(map_addr_, map_bytes_);
     if (client_n_ > 0)
         delete [] mtx_;
 }
 
+// Keep columns out of core
+template <class T>
+void MatrixLoader<T>::SetOutOfCore(std::string cache_file, long max_bytes, 
+        int block_size) {
+    CHECK_GT(block_size, 0) << "Block size must be positive";
+    out_of_core_ = true;
+    cache_file_ = cache_file;
+    max_cache_bytes_ = max_bytes;
+    block_size_ = block_size;
+    CHECK((cache_fp_ = fopen(cache_file_.c_str(), "wb")) != NULL)
+        << "Fails to open " << cache_file_;
+}
+
+// Whether columns are kept out of core
+template <class T>
+bool MatrixLoader<T>::IsOutOfCore() {
+    return out_of_core_;
+}
+
+// Keep columns in reduced precision
+template <class T>
+void MatrixLoader<T>::SetPrecision(std::string precision) {
+    CHECK((std::is_same<T, float>::value)) 
+        << "Reduced precision requires float elements";
+    if (precision == "fp32") {
+        precision_ = kFP32;
+    } else if (precision == "fp16") {
+        precision_ = kFP16;
+    } else if (precision == "bf16") {
+        precision_ = kBF16;
+    } else if (precision == "int8") {
+        precision_ = kInt8;
+    } else {
+        LOG(FATAL) << "Unrecognized precision: " << precision;
+    }
+    CHECK(precision_ == kFP32 || !out_of_core_) 
+        << "Out-of-core columns are kept in fp32";
+}
+
+// Average squared error of narrowing columns
+template <class T>
+double MatrixLoader<T>::GetQuantizationError() {
+    return (client_n_ > 0)? quant_error_ / client_n_: 0.0;
+}
+
+// Read the next column of m elements from a file in data_format "binary" or
+// "text", returns false if the file ends before
+template <class T>
+static bool ReadFileCol(FILE * fp, std::string data_format, int m, T * col) {
+    if (data_format == "binary") {
+        return fread(col, sizeof(T), m, fp) == size_t(m);
+    }
+    int num_read = 0;
+    for (int i = 0; i < m; ++i) {
+        if (typeid(T) == typeid(int)) {
+            num_read += fscanf(fp, "%d", (int *)&col[i]);
+        } else if (typeid(T) == typeid(float)) {
+            num_read += fscanf(fp, "%f", (float *)&col[i]);
+        } else if (typeid(T) == typeid(double)) {
+            num_read += fscanf(fp, "%lf", (double *)&col[i]);
+        } else {
+            LOG(FATAL) << "Unsupported type: " << typeid(T).name();
+        }
+    }
+    return num_read == m;
+}
+
 // Init matrix from unpartitioned file
 template <class T>
 void MatrixLoader<T>::Init(std::string data_file, std::string data_format, 
-        int m, int n, int client_id, int num_clients) {
+        int m, int n, int client_id, int num_clients, int num_threads) {
     FILE * fp = NULL;
-    if (data_format == "binary") {
-        CHECK((fp = fopen(data_file.c_str(), "rb")) != NULL) 
-            << "Fails to open " << data_file;
-    } else if (data_format == "text") {
-        CHECK((fp = fopen(data_file.c_str(), "r")) != NULL)
-            << "Fails to open " << data_file;
+    if (IsShardDirectory(data_file)) {
+        InitShards(data_file, data_format, m, n, client_id, num_clients, 
+                num_threads);
+        return;
+    } else if (data_format == "nmf") {
+        InitNMF(data_file, m, n, client_id, num_clients, num_threads);
+        return;
+    } else if (data_format == "npy") {
+        InitNpy(data_file, m, n, client_id, num_clients, num_threads);
+        return;
+    } else if (data_format == "binary" || data_format == "text") {
+        // Compressed files are decompressed as they are read
+        fp = OpenDataFile(data_file, num_threads);
     } else {
         LOG(FATAL) << "Unrecognized data format: " << data_format;
     }
@@ -45,34 +241,26 @@ void MatrixLoader<T>::Init(std::string data_file, std::string data_format,
         // Calculate number of columns on given client
         client_n_ = (n - (n / num_clients) * num_clients > client_id)?
             n / num_clients + 1: n / num_clients;
-        data_.resize(client_n_);
-        for (int k = 0; k < client_n_; k++) {
-            data_[k].resize(m);
-        }
+        AllocCols();
 
         // Read data from file
-        T temp;
+        std::vector<T> col(m);
         for (int j = 0; j < n; ++j) {
-            for (int i = 0; i < m; ++i) {
-                if (data_format == "binary") {
-                    fread(&temp, sizeof(T), 1, fp);
-                } else if (data_format == "text") {
-                    if (typeid(T) == typeid(int)) {
-                        fscanf(fp, "%d", (int *)&temp);
-                    } else if (typeid(T) == typeid(float)) {
-                        fscanf(fp, "%f", (float *)&temp);
-                    } else if (typeid(T) == typeid(double)) {
-                        fscanf(fp, "%lf", (double *)&temp);
-                    } else {
-                        LOG(FATAL) << "Unsupported type: " << typeid(T).name();
-                    }
-                }
-                if (j % num_clients == client_id) {
-                    data_[j / num_clients][i] = temp;
-                }
+            ReadFileCol(fp, data_format, m, col.data());
+            if (j % num_clients == client_id) {
+                StoreCol(j / num_clients, col.data());
             }
         }
+        FinishOutOfCore();
         mtx_ = new std::mutex[client_n_];
+        col_grad_norm_.assign(client_n_, std::numeric_limits<T>::max());
+        col_sparse_.assign(client_n_, 0);
+        sparse_idx_.resize(client_n_);
+        sparse_val_.resize(client_n_);
+        global_cols_.resize(client_n_);
+        for (int k = 0; k < client_n_; ++k) {
+            global_cols_[k] = client_id + k * num_clients;
+        }
         fclose(fp);
     }
 }
@@ -80,14 +268,22 @@ void MatrixLoader<T>::Init(std::string data_file, std::string data_format,
 // Init matrix from partitioned file
 template <class T>
 void MatrixLoader<T>::Init(std::string data_file, std::string data_format,
-        int m, int client_n) { 
+        int m, int client_n, int num_threads) { 
     FILE * fp = NULL;
-    if (data_format == "binary") {
-        CHECK((fp = fopen(data_file.c_str(), "rb")) != NULL) 
-            << "Fails to open " << data_file;
-    } else if (data_format == "text") {
-        CHECK((fp = fopen(data_file.c_str(), "r")) != NULL)
-            << "Fails to open " << data_file;
+    CHECK(!IsShardDirectory(data_file)) << "Columns of directories of shards"
+        " are assigned to clients at runtime, which are not partitioned";
+    if (data_format == "nmf") {
+        // The file holds exactly the columns of this client
+        InitNMF(data_file, m, client_n, 0, 1, num_threads);
+        global_cols_.clear();
+        return;
+    } else if (data_format == "npy") {
+        InitNpy(data_file, m, client_n, 0, 1, num_threads);
+        global_cols_.clear();
+        return;
+    } else if (data_format == "binary" || data_format == "text") {
+        // Compressed files are decompressed as they are read
+        fp = OpenDataFile(data_file, num_threads);
     } else {
         LOG(FATAL) << "Unrecognized data format: " << data_format;
     }
@@ -98,57 +294,600 @@ void MatrixLoader<T>::Init(std::string data_file, std::string data_format,
         return;
     }
     else {
-        data_.resize(client_n);
-        for (int k = 0; k < client_n; k++) {
-            data_[k].resize(m_);
-        }
+        AllocCols();
 
         // Read data from file
-        T temp;
+        std::vector<T> col(m_);
         for (int j = 0; j < client_n; ++j) {
-            for (int i = 0; i < m_; ++i) {
-                if (data_format == "binary") {
-                    fread(&temp, sizeof(T), 1, fp);
-                } else if (data_format == "text") {
-                    if (typeid(T) == typeid(int)) {
-                        fscanf(fp, "%d", (int *)&temp);
-                    } else if (typeid(T) == typeid(float)) {
-                        fscanf(fp, "%f", (float *)&temp);
-                    } else if (typeid(T) == typeid(double)) {
-                        fscanf(fp, "%lf", (double *)&temp);
-                    } else {
-                        LOG(FATAL) << "Unsupported type: " << typeid(T).name();
-                    }
+            ReadFileCol(fp, data_format, m_, col.data());
+            StoreCol(j, col.data());
+        }
+        FinishOutOfCore();
+        mtx_ = new std::mutex[client_n];
+        col_grad_norm_.assign(client_n, std::numeric_limits<T>::max());
+        col_sparse_.assign(client_n, 0);
+        sparse_idx_.resize(client_n);
+        sparse_val_.resize(client_n);
+        fclose(fp);
+    }
+}
+
+// Init matrix from file in format "nmf"
+template <class T>
+void MatrixLoader<T>::InitNMF(std::string data_file, int m, int n, 
+        int client_id, int num_clients, int num_threads) {
+    MatrixFileReader reader;
+    reader.Open(data_file);
+    CHECK(reader.GetRows() == m && reader.GetCols() == n) << data_file 
+        << " is " << reader.GetRows() << "-by-" << reader.GetCols() 
+        << " instead of " << m << "-by-" << n;
+    m_ = m;
+    // Only the chunks holding the columns of the client are read
+    int first_col = AssignColRange(n, client_id, num_clients);
+    if (client_n_ == 0)
+        return;
+    AllocCols();
+
+    // Threads take chunks in turn. Out-of-core columns are appended to the
+    // cache file in order, which takes a single thread
+    long chunk_cols = reader.GetChunkCols();
+    long last_chunk = (first_col + client_n_ - 1) / chunk_cols;
+    std::atomic<long> next_chunk(first_col / chunk_cols);
+    if (out_of_core_)
+        num_threads = 1;
+    auto read = [&]() {
+        std::vector<float> chunk;
+        std::vector<T> col(m);
+        long c;
+        while ((c = next_chunk++) <= last_chunk) {
+            int num_cols = reader.ReadChunk(c, chunk);
+            for (int q = 0; q < num_cols; ++q) {
+                long k = c * chunk_cols + q - first_col;
+                if (k < 0 || k >= client_n_)
+                    continue;
+                std::copy(chunk.begin() + long(q) * m, 
+                        chunk.begin() + long(q + 1) * m, col.begin());
+                StoreCol(k, col.data());
+            }
+        }
+    };
+    std::vector<std::thread> threads(num_threads - 1);
+    for (auto & thr: threads) {
+        thr = std::thread(read);
+    }
+    read();
+    for (auto & thr: threads) {
+        thr.join();
+    }
+    FinishOutOfCore();
+    LOG(INFO) << "client " << client_id << " loaded columns " << first_col 
+        << " to " << first_col + client_n_ - 1 << " from " << data_file;
+    mtx_ = new std::mutex[client_n_];
+    col_grad_norm_.assign(client_n_, std::numeric_limits<T>::max());
+    col_sparse_.assign(client_n_, 0);
+    sparse_idx_.resize(client_n_);
+    sparse_val_.resize(client_n_);
+}
+
+// Init matrix from .npy file
+template <class T>
+void MatrixLoader<T>::InitNpy(std::string data_file, int m, int n, 
+        int client_id, int num_clients, int num_threads) {
+    NpyFileReader reader;
+    reader.Open(data_file);
+    CHECK(reader.GetRows() == m && reader.GetCols() == n) << data_file 
+        << " is " << reader.GetRows() << "-by-" << reader.GetCols() 
+        << " instead of " << m << "-by-" << n;
+    m_ = m;
+    int first_col = AssignColRange(n, client_id, num_clients);
+    if (client_n_ == 0)
+        return;
+    AllocCols();
+
+    if (reader.IsFortranOrder() && std::is_same<T, float>::value 
+            && reader.GetItemSize() == sizeof(T) && !out_of_core_ 
+            && precision_ == kFP32) {
+        // Columns are contiguous in the file and are used in place
+        map_file_ = data_file;
+        int fd = open(data_file.c_str(), O_RDONLY);
+        CHECK_GE(fd, 0) << "Fails to open " << data_file;
+        map_bytes_ = reader.GetDataOffset() + size_t(m) * n * sizeof(T);
+        map_addr_ = mmap(NULL, map_bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+        CHECK(map_addr_ != MAP_FAILED) << "Fails to map " << data_file;
+        close(fd);
+        mapped_ = (T *)((char *)map_addr_ + reader.GetDataOffset()) 
+            + size_t(first_col) * m;
+        LOG(INFO) << "client " << client_id << " mapped columns " 
+            << first_col << " to " << first_col + client_n_ - 1 << " of " 
+            << data_file;
+    } else {
+        // Threads take blocks of columns in turn, out-of-core columns are 
+        // appended to the cache file in order by a single thread
+        const int block_cols = 256;
+        std::atomic<int> next_block(0);
+        if (out_of_core_)
+            num_threads = 1;
+        auto read = [&]() {
+            std::vector<float> block;
+            std::vector<T> col(m);
+            int b;
+            while ((b = next_block++) * block_cols < client_n_) {
+                int k_begin = b * block_cols;
+                int k_end = std::min(client_n_, k_begin + block_cols);
+                block.resize(long(k_end - k_begin) * m);
+                reader.ReadCols(first_col + k_begin, first_col + k_end, 
+                        block.data());
+                for (int k = k_begin; k < k_end; ++k) {
+                    std::copy(block.begin() + long(k - k_begin) * m, 
+                            block.begin() + long(k - k_begin + 1) * m, 
+                            col.begin());
+                    StoreCol(k, col.data());
                 }
-                data_[j][i] = temp;
             }
+        };
+        std::vector<std::thread> threads(num_threads - 1);
+        for (auto & thr: threads) {
+            thr = std::thread(read);
+        }
+        read();
+        for (auto & thr: threads) {
+            thr.join();
+        }
+        FinishOutOfCore();
+        LOG(INFO) << "client " << client_id << " loaded columns " 
+            << first_col << " to " << first_col + client_n_ - 1 << " from " 
+            << data_file;
+    }
+    mtx_ = new std::mutex[client_n_];
+    col_grad_norm_.assign(client_n_, std::numeric_limits<T>::max());
+    col_sparse_.assign(client_n_, 0);
+    sparse_idx_.resize(client_n_);
+    sparse_val_.resize(client_n_);
+}
+
+// Init matrix from directory of shards
+template <class T>
+void MatrixLoader<T>::InitShards(std::string data_dir, 
+        std::string data_format, int m, int n, int client_id, 
+        int num_clients, int num_threads) {
+    long rows, cols;
+    std::vector<MatrixShard> shards;
+    ReadShardManifest(data_dir, rows, cols, shards);
+    CHECK(rows == m && cols == n) << data_dir << " is " << rows << "-by-" 
+        << cols << " instead of " << m << "-by-" << n;
+    m_ = m;
+    int first_col = AssignColRange(n, client_id, num_clients);
+    if (client_n_ == 0)
+        return;
+    AllocCols();
+    int end_col = first_col + client_n_;
+    std::vector<MatrixShard> client_shards;
+    for (const MatrixShard & shard: shards) {
+        if (shard.first_col < end_col 
+                && shard.first_col + shard.num_cols > first_col)
+            client_shards.push_back(shard);
+    }
+
+    // Threads take shards in turn, out-of-core columns are appended to the
+    // cache file in order by a single thread
+    std::atomic<int> next_shard(0);
+    if (out_of_core_)
+        num_threads = 1;
+    auto read = [&]() {
+        int s;
+        while ((s = next_shard++) < (int)client_shards.size()) {
+            const MatrixShard & shard = client_shards[s];
+            long col_begin = std::max<long>(first_col, shard.first_col);
+            long col_end = std::min<long>(end_col, 
+                    shard.first_col + shard.num_cols);
+            ReadShard(shard.file, data_format, shard.num_cols, 
+                    col_begin - shard.first_col, col_end - shard.first_col, 
+                    col_begin - first_col);
+        }
+    };
+    std::vector<std::thread> threads(
+            std::min<int>(num_threads, client_shards.size()) - 1);
+    for (auto & thr: threads) {
+        thr = std::thread(read);
+    }
+    read();
+    for (auto & thr: threads) {
+        thr.join();
+    }
+    FinishOutOfCore();
+    LOG(INFO) << "client " << client_id << " loaded columns " << first_col 
+        << " to " << end_col - 1 << " from " << client_shards.size() 
+        << " of " << shards.size() << " shards of " << data_dir;
+    mtx_ = new std::mutex[client_n_];
+    col_grad_norm_.assign(client_n_, std::numeric_limits<T>::max());
+    col_sparse_.assign(client_n_, 0);
+    sparse_idx_.resize(client_n_);
+    sparse_val_.resize(client_n_);
+}
+
+// Read columns of a shard
+template <class T>
+void MatrixLoader<T>::ReadShard(std::string file, std::string data_format, 
+        long num_cols, long col_begin, long col_end, int first_local) {
+    std::vector<float> block;
+    std::vector<T> col(m_);
+    if (data_format == "nmf") {
+        MatrixFileReader reader;
+        reader.Open(file);
+        CHECK(reader.GetRows() == m_ && reader.GetCols() == num_cols) 
+            << file << " is " << reader.GetRows() << "-by-" 
+            << reader.GetCols() << " instead of " << m_ << "-by-" 
+            << num_cols;
+        long chunk_cols = reader.GetChunkCols();
+        for (long c = col_begin / chunk_cols; c * chunk_cols < col_end; ++c) {
+            int chunk_n = reader.ReadChunk(c, block);
+            for (int q = 0; q < chunk_n; ++q) {
+                long j = c * chunk_cols + q;
+                if (j < col_begin || j >= col_end)
+                    continue;
+                std::copy(block.begin() + long(q) * m_, 
+                        block.begin() + long(q + 1) * m_, col.begin());
+                StoreCol(j - col_begin + first_local, col.data());
+            }
+        }
+    } else if (data_format == "npy") {
+        NpyFileReader reader;
+        reader.Open(file);
+        CHECK(reader.GetRows() == m_ && reader.GetCols() == num_cols) 
+            << file << " is " << reader.GetRows() << "-by-" 
+            << reader.GetCols() << " instead of " << m_ << "-by-" 
+            << num_cols;
+        const long block_cols = 256;
+        for (long j0 = col_begin; j0 < col_end; j0 += block_cols) {
+            long j1 = std::min(col_end, j0 + block_cols);
+            block.resize((j1 - j0) * m_);
+            reader.ReadCols(j0, j1, block.data());
+            for (long j = j0; j < j1; ++j) {
+                std::copy(block.begin() + (j - j0) * m_, 
+                        block.begin() + (j - j0 + 1) * m_, col.begin());
+                StoreCol(j - col_begin + first_local, col.data());
+            }
+        }
+    } else if (data_format == "binary" || data_format == "text") {
+        FILE * fp = OpenDataFile(file);
+        // Plain binary shards are sought, others are read up to col_begin
+        long j = 0;
+        if (data_format == "binary" 
+                && fseek(fp, col_begin * m_ * sizeof(T), SEEK_SET) == 0)
+            j = col_begin;
+        for (; j < col_end; ++j) {
+            CHECK(ReadFileCol(fp, data_format, m_, col.data())) 
+                << file << " holds less than " << col_end << " columns";
+            if (j >= col_begin)
+                StoreCol(j - col_begin + first_local, col.data());
         }
-        mtx_ = new std::mutex[client_n];
         fclose(fp);
+    } else {
+        LOG(FATAL) << "Unrecognized data format of shards: " << data_format;
+    }
+}
+
+// Assign a contiguous range of columns to the client
+template <class T>
+int MatrixLoader<T>::AssignColRange(int n, int client_id, int num_clients) {
+    // Each client gets as many columns as partitioning by id would give it
+    client_n_ = (n - (n / num_clients) * num_clients > client_id)?
+        n / num_clients + 1: n / num_clients;
+    int first_col = client_id * (n / num_clients) 
+        + std::min(client_id, n % num_clients);
+    global_cols_.resize(client_n_);
+    for (int k = 0; k < client_n_; ++k) {
+        global_cols_[k] = first_col + k;
+    }
+    return first_col;
+}
+
+// Buffered stream over a FILE * opened for reading
+class FileStreamBuf: public std::streambuf {
+    public:
+        FileStreamBuf(FILE * fp): fp_(fp), buffer_(1 << 16) {
+        }
+
+    protected:
+        int_type underflow() {
+            size_t bytes = fread(buffer_.data(), 1, buffer_.size(), fp_);
+            if (bytes == 0)
+                return traits_type::eof();
+            setg(buffer_.data(), buffer_.data(), buffer_.data() + bytes);
+            return traits_type::to_int_type(*gptr());
+        }
+
+    private:
+        FILE * fp_;
+        std::vector<char> buffer_;
+};
+
+// Count the nonzeros of each column of a sparse file, and with local_col 
+// given, append the nonzeros of columns j with local_col[j] >= 0 to idx and
+// val at local_col[j]. In "libsvm" format line j 
+// holds column j as 1-based "row:value" pairs after an optional label, in 
+// "mtx" format entries are 1-based "row column value" triplets after a 
+// MatrixMarket coordinate header
+template <class T>
+static void ReadSparseFile(std::string data_file, std::string data_format, 
+        int m, int n, int num_threads, std::vector<int> & col_nnz, 
+        const std::vector<int> * local_col = NULL, 
+        std::vector<std::vector<int> > * idx = NULL, 
+        std::vector<std::vector<T> > * val = NULL) {
+    // Compressed files are decompressed as they are read, the file is 
+    // closed after the stream over it
+    std::unique_ptr<FILE, int (*)(FILE *)> file(
+            OpenDataFile(data_file, num_threads), fclose);
+    FileStreamBuf file_buf(file.get());
+    std::istream fin(&file_buf);
+    col_nnz.assign(n, 0);
+    auto add = [&](int i, int j, T v) {
+        CHECK(i >= 0 && i < m && j >= 0 && j < n) 
+            << "Entry (" << i + 1 << ", " << j + 1 << ") out of range in " 
+            << data_file;
+        ++col_nnz[j];
+        if (local_col && (*local_col)[j] >= 0) {
+            (*idx)[(*local_col)[j]].push_back(i);
+            (*val)[(*local_col)[j]].push_back(v);
+        }
+    };
+    std::string line;
+    if (data_format == "libsvm") {
+        int j = 0;
+        while (std::getline(fin, line)) {
+            CHECK_LT(j, n) << "More than " << n << " columns in " << data_file;
+            const char * p = line.c_str();
+            char * end;
+            while (*p != '\0' && *p != '#') {
+                long i = strtol(p, &end, 10);
+                if (end == p) {
+                    // skip whitespace
+                    ++p;
+                } else if (*end == ':') {
+                    p = end + 1;
+                    add(i - 1, j, T(strtod(p, &end)));
+                    CHECK(end != p) << "Missing value at line " << j + 1 
+                        << " of " << data_file;
+                    p = end;
+                } else {
+                    // label
+                    strtod(p, &end);
+                    p = end;
+                }
+            }
+            ++j;
+        }
+        CHECK_EQ(j, n) << "Number of columns in " << data_file;
+    } else if (data_format == "mtx") {
+        bool pattern = false;
+        std::getline(fin, line);
+        CHECK(line.find("%%MatrixMarket") == 0 
+                && line.find("coordinate") != std::string::npos 
+                && line.find("general") != std::string::npos)
+            << "Only general coordinate MatrixMarket files are supported";
+        pattern = (line.find("pattern") != std::string::npos);
+        while (std::getline(fin, line) && line[0] == '%') {
+        }
+        int rows, cols;
+        long nnz;
+        CHECK_EQ(sscanf(line.c_str(), "%d %d %ld", &rows, &cols, &nnz), 3)
+            << "Missing size line in " << data_file;
+        CHECK(rows == m && cols == n) << data_file << " is " << rows 
+            << "-by-" << cols << " instead of " << m << "-by-" << n;
+        for (long p = 0; p < nnz; ++p) {
+            int i, j;
+            double v = 1.0;
+            CHECK(fin >> i >> j && (pattern || fin >> v)) 
+                << "Missing entries in " << data_file;
+            add(i - 1, j - 1, T(v));
+        }
+    } else {
+        LOG(FATAL) << "Unrecognized data format: " << data_format;
+    }
+}
+
+// Init matrix from sparse file
+template <class T>
+void MatrixLoader<T>::InitSparse(std::string data_file, 
+        std::string data_format, int m, int n, int client_id, 
+        int num_clients, int num_threads) {
+    CHECK(!IsShardDirectory(data_file)) << "Directories of shards hold dense"
+        " matrices";
+    m_ = m;
+    // First pass counts nonzeros, then columns are assigned in decreasing 
+    // order of nonzeros to the client with fewest nonzeros. No client gets
+    // more than the ceil(n / num_clients) columns of partitioning by id
+    std::vector<int> col_nnz;
+    ReadSparseFile<T>(data_file, data_format, m, n, num_threads, col_nnz);
+    std::vector<int> order(n);
+    for (int j = 0; j < n; ++j) {
+        order[j] = j;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return col_nnz[a] > col_nnz[b]; });
+    int max_client_n = (n + num_clients - 1) / num_clients;
+    typedef std::pair<long, int> Load;
+    std::priority_queue<Load, std::vector<Load>, std::greater<Load> > loads;
+    for (int c = 0; c < num_clients; ++c) {
+        loads.push(Load(0, c));
+    }
+    std::vector<int> num_cols(num_clients, 0);
+    global_cols_.clear();
+    for (int j: order) {
+        Load load = loads.top();
+        loads.pop();
+        if (load.second == client_id)
+            global_cols_.push_back(j);
+        if (++num_cols[load.second] < max_client_n)
+            loads.push(Load(load.first + col_nnz[j], load.second));
     }
+    // Columns are kept in increasing global order
+    std::sort(global_cols_.begin(), global_cols_.end());
+    client_n_ = global_cols_.size();
+    if (client_n_ == 0)
+        return;
+    std::vector<int> local_col(n, -1);
+    for (int k = 0; k < client_n_; ++k) {
+        local_col[global_cols_[k]] = k;
+    }
+    // Second pass reads nonzeros of owned columns
+    data_.resize(client_n_);
+    col_sparse_.assign(client_n_, 1);
+    sparse_idx_.assign(client_n_, std::vector<int>());
+    sparse_val_.assign(client_n_, std::vector<T>());
+    for (int k = 0; k < client_n_; ++k) {
+        sparse_idx_[k].reserve(col_nnz[global_cols_[k]]);
+        sparse_val_[k].reserve(col_nnz[global_cols_[k]]);
+    }
+    ReadSparseFile<T>(data_file, data_format, m, n, num_threads, col_nnz, 
+            &local_col, &sparse_idx_, &sparse_val_);
+    long nnz = 0;
+    for (int k = 0; k < client_n_; ++k) {
+        // Sort by row and sum up duplicates
+        std::vector<int> & idx = sparse_idx_[k];
+        std::vector<T> & val = sparse_val_[k];
+        std::vector<int> perm(idx.size());
+        for (int p = 0; p < (int)perm.size(); ++p) {
+            perm[p] = p;
+        }
+        std::sort(perm.begin(), perm.end(), [&](int a, int b) {
+                return idx[a] < idx[b]; });
+        std::vector<int> sorted_idx;
+        std::vector<T> sorted_val;
+        for (int p: perm) {
+            if (!sorted_idx.empty() && sorted_idx.back() == idx[p]) {
+                sorted_val.back() += val[p];
+            } else {
+                sorted_idx.push_back(idx[p]);
+                sorted_val.push_back(val[p]);
+            }
+        }
+        idx.swap(sorted_idx);
+        val.swap(sorted_val);
+        nnz += idx.size();
+    }
+    LOG(INFO) << "client " << client_id << " loaded " << client_n_ 
+        << " columns with " << nnz << " nonzeros from " << data_file;
+    mtx_ = new std::mutex[client_n_];
+    col_grad_norm_.assign(client_n_, std::numeric_limits<T>::max());
 }
 
 // Init matrix of m-by-client_n with random data ranging from low to high
 template <class T>
-void MatrixLoader<T>::Init(int m, int client_n, T low, T high) {
+void MatrixLoader<T>::Init(int m, int client_n, T low, T high, unsigned seed, 
+        const std::vector<int> & global_cols, int num_threads) {
     m_ = m;
     client_n_ = client_n;
     if (client_n == 0) {
         return;
     }
     else {
-        srand((unsigned)time(NULL));
         data_.resize(client_n);
-        for (int k = 0; k < client_n; k++) {
-            data_[k].resize(m);
-            for (int i = 0; i < m; i++) {
-                data_[k][i] = low + T(rand()) / RAND_MAX * (high - low);
+        // Thread t fills columns k = t mod num_threads
+        auto fill = [&](int thread_id) {
+            std::uniform_real_distribution<T> uniform(low, high);
+            for (int k = thread_id; k < client_n; k += num_threads) {
+                std::seed_seq seq{seed, 2u, 
+                    (unsigned)(global_cols.empty()? k: global_cols[k])};
+                std::mt19937 rng(seq);
+                if (mapped_ == NULL)
+                    data_[k].resize(m);
+                T * col = DenseCol(k);
+                for (int i = 0; i < m; i++) {
+                    col[i] = uniform(rng);
+                }
             }
+        };
+        std::vector<std::thread> threads(num_threads - 1);
+        for (int t = 1; t < num_threads; ++t) {
+            threads[t - 1] = std::thread(fill, t);
+        }
+        fill(0);
+        for (auto & thr: threads) {
+            thr.join();
         }
         mtx_ = new std::mutex[client_n];
+        col_grad_norm_.assign(client_n, std::numeric_limits<T>::max());
+        col_sparse_.assign(client_n, 0);
+        sparse_idx_.resize(client_n);
+        sparse_val_.resize(client_n);
     }
 }
 
+// Init matrix backed by a mapped file
+template <class T>
+void MatrixLoader<T>::InitMapped(std::string map_file, bool keep_existing, 
+        int m, int client_n, T low, T high, unsigned seed, 
+        const std::vector<int> & global_cols, int num_threads) {
+    const int32_t magic = 0x53464D4E, version = 1;
+    const size_t header_bytes = 4 * sizeof(int32_t);
+    map_file_ = map_file;
+    map_bytes_ = header_bytes + size_t(m) * client_n * sizeof(T);
+    int fd = open(map_file.c_str(), keep_existing? O_RDWR: O_RDWR | O_CREAT,
+            0644);
+    CHECK_GE(fd, 0) << "Fails to open " << map_file;
+    if (keep_existing) {
+        struct stat st;
+        CHECK(fstat(fd, &st) == 0 && size_t(st.st_size) == map_bytes_)
+            << map_file << " does not hold a " << m << "-by-" << client_n 
+            << " matrix";
+    } else {
+        CHECK_EQ(ftruncate(fd, map_bytes_), 0) << "Fails to resize " 
+            << map_file;
+    }
+    map_addr_ = mmap(NULL, map_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, 
+            fd, 0);
+    CHECK(map_addr_ != MAP_FAILED) << "Fails to map " << map_file;
+    close(fd);
+    int32_t * header = (int32_t *)map_addr_;
+    mapped_ = (T *)((char *)map_addr_ + header_bytes);
+    if (!keep_existing) {
+        header[0] = magic;
+        header[1] = version;
+        header[2] = m;
+        header[3] = client_n;
+        Init(m, client_n, low, high, seed, global_cols, num_threads);
+        return;
+    }
+    CHECK(header[0] == magic && header[1] == version && header[2] == m 
+            && header[3] == client_n) << map_file << " does not hold a " 
+        << m << "-by-" << client_n << " matrix";
+    LOG(INFO) << "mapped " << m << "-by-" << client_n << " matrix from " 
+        << map_file;
+    m_ = m;
+    client_n_ = client_n;
+    if (client_n == 0)
+        return;
+    data_.resize(client_n);
+    mtx_ = new std::mutex[client_n];
+    col_grad_norm_.assign(client_n, std::numeric_limits<T>::max());
+    col_sparse_.assign(client_n, 0);
+    sparse_idx_.resize(client_n);
+    sparse_val_.resize(client_n);
+}
+
+// Whether the matrix is backed by a mapped file
+template <class T>
+bool MatrixLoader<T>::IsMapped() {
+    return mapped_ != NULL;
+}
+
+// Flush the mapped file
+template <class T>
+void MatrixLoader<T>::Sync() {
+    if (map_addr_ != NULL) {
+        CHECK_EQ(msync(map_addr_, map_bytes_, MS_SYNC), 0) 
+            << "Fails to sync " << map_file_;
+    }
+}
+
+// Elements of dense column
+template <class T>
+T * MatrixLoader<T>::DenseCol(int j_client) {
+    return (mapped_ != NULL)? mapped_ + size_t(j_client) * m_: 
+        data_[j_client].data();
+}
+
 // Get statistics of matrix
 template <class T>
 int MatrixLoader<T>::GetM() {
@@ -161,13 +900,24 @@ int MatrixLoader<T>::GetClientN() {
     return client_n_;
 }
 
+// Get global column ids
+template <class T>
+const std::vector<int> & MatrixLoader<T>::GetGlobalCols() {
+    return global_cols_;
+}
+
 // Get a column of matrix
 template <class T>
 bool MatrixLoader<T>::GetCol(int j_client, std::vector<T> & col) {
     if (client_n_ == 0)
         return false;
     std::unique_lock<std::mutex> lck (*(mtx_+j_client));
-    col = data_[j_client];
+    if (col_sparse_[j_client] || out_of_core_ || precision_ != kFP32) {
+        col.resize(m_);
+        ReadCol(j_client, col.data());
+    } else {
+        col.assign(DenseCol(j_client), DenseCol(j_client) + m_);
+    }
     return true;
 }
 
@@ -178,8 +928,36 @@ bool MatrixLoader<T>::GetCol(int j_client,
     if (client_n_ == 0)
         return false;
     std::unique_lock<std::mutex> lck (*(mtx_+j_client));
+    ReadCol(j_client, col.data());
+    return true;
+}
+
+// Get nonzeros of a column of matrix
+template <class T>
+bool MatrixLoader<T>::GetSparseCol(int j_client, std::vector<int> & idx, 
+        std::vector<T> & val) {
+    if (client_n_ == 0)
+        return false;
+    std::unique_lock<std::mutex> lck (*(mtx_+j_client));
+    if (col_sparse_[j_client]) {
+        idx = sparse_idx_[j_client];
+        val = sparse_val_[j_client];
+        return true;
+    }
+    static thread_local std::vector<T> buffer;
+    const T * col = DenseCol(j_client);
+    if (out_of_core_ || precision_ != kFP32) {
+        buffer.resize(m_);
+        col = buffer.data();
+        ReadCol(j_client, buffer.data());
+    }
+    idx.clear();
+    val.clear();
     for (int i = 0; i < m_; ++i) {
-        col(i) = data_[j_client][i];
+        if (col[i] != 0.0) {
+            idx.push_back(i);
+            val.push_back(col[i]);
+        }
     }
     return true;
 }
@@ -189,7 +967,8 @@ template <class T>
 bool MatrixLoader<T>::GetRandCol(int & j_client, std::vector<T> & col) {
     if (client_n_ == 0)
         return false;
-    j_client = rand() % client_n_;
+    T weight;
+    j_client = SampleCol(weight);
     GetCol(j_client, col);
     return true;
 }
@@ -200,92 +979,473 @@ bool MatrixLoader<T>::GetRandCol(int & j_client,
         Eigen::Matrix<T, Eigen::Dynamic, 1> & col) {
     if (client_n_ == 0)
         return false;
-    j_client = rand() % client_n_;
+    T weight;
+    j_client = SampleCol(weight);
+    GetCol(j_client, col);
+    return true;
+}
+
+// Get a random column of matrix with its importance weight
+template <class T>
+bool MatrixLoader<T>::GetRandCol(int & j_client, 
+        Eigen::Matrix<T, Eigen::Dynamic, 1> & col, T & weight) {
+    if (client_n_ == 0)
+        return false;
+    j_client = SampleCol(weight);
     GetCol(j_client, col);
     return true;
 }
 
+// Get a random column id with its importance weight
+template <class T>
+bool MatrixLoader<T>::GetRandColId(int & j_client, T & weight) {
+    if (client_n_ == 0)
+        return false;
+    j_client = SampleCol(weight);
+    return true;
+}
+
+// Get a uniformly random column id without side effects on prefetching
+template <class T>
+bool MatrixLoader<T>::GetUniformColId(int & j_client) {
+    if (client_n_ == 0)
+        return false;
+    if (out_of_core_) {
+        std::unique_lock<std::mutex> lck(block_mtx_);
+        j_client = SampleResidentCol();
+    } else {
+        j_client = rand() % client_n_;
+    }
+    return true;
+}
+
 // Modify column of matrix
 template <class T>
 void MatrixLoader<T>::IncCol(int j_client, std::vector<T> & inc) {
-    std::unique_lock<std::mutex> lck (*(mtx_+j_client));
-    for (int i = 0; i < m_; ++i) {
-        data_[j_client][i] += inc[i];
-        if ((data_[j_client][i] > -INFINITESIMAL) 
-                && (data_[j_client][i] < INFINITESIMAL)) {
-            data_[j_client][i] = 0.0;
-        }
-        if (data_[j_client][i] > MAXELEVAL) {
-            data_[j_client][i] = MAXELEVAL;
-        }
-        if (data_[j_client][i] < MINELEVAL) {
-            data_[j_client][i] = MINELEVAL;
-        }
-    }
+    IncColClamped(j_client, inc.data(), MINELEVAL);
 }
 
 // Modify column of matrix
 template <class T>
 void MatrixLoader<T>::IncCol(int j_client, std::vector<T> & inc, T low) {
+    IncColClamped(j_client, inc.data(), low);
+}
+
+// Modify column of matrix
+template <class T>
+void MatrixLoader<T>::IncCol(int j_client, 
+        Eigen::Matrix<T, Eigen::Dynamic, 1> & inc) {
+    IncColClamped(j_client, inc.data(), MINELEVAL);
+}
+
+// Modify column of matrix
+template <class T>
+void MatrixLoader<T>::IncCol(int j_client, 
+        Eigen::Matrix<T, Eigen::Dynamic, 1> & inc, T low) {
+    IncColClamped(j_client, inc.data(), low);
+}
+
+// Modify column of matrix, working on a dense copy of sparse columns
+template <class T>
+void MatrixLoader<T>::IncColClamped(int j_client, const T * inc, T low) {
+    CHECK(!out_of_core_ && precision_ == kFP32) 
+        << "Out-of-core and reduced-precision columns are read only";
     std::unique_lock<std::mutex> lck (*(mtx_+j_client));
-    for (int i = 0; i < m_; ++i) {
-        data_[j_client][i] += inc[i];
-        if ((data_[j_client][i] > -INFINITESIMAL) 
-                && (data_[j_client][i] < INFINITESIMAL)) {
-            data_[j_client][i] = 0.0;
+    static thread_local std::vector<T> buffer;
+    T * col = DenseCol(j_client);
+    if (col_sparse_[j_client]) {
+        buffer.resize(m_);
+        col = buffer.data();
+        ReadCol(j_client, col);
+    }
+    for (int i = 0; i < m_; i++) {
+        col[i] += inc[i];
+        if ((col[i] > -INFINITESIMAL) && (col[i] < INFINITESIMAL)) {
+            col[i] = 0.0;
         }
-        if (data_[j_client][i] > MAXELEVAL) {
-            data_[j_client][i] = MAXELEVAL;
+        if (col[i] > MAXELEVAL) {
+            col[i] = MAXELEVAL;
         }
-        if (data_[j_client][i] < MINELEVAL) {
-            data_[j_client][i] = MINELEVAL;
+        if (col[i] < MINELEVAL) {
+            col[i] = MINELEVAL;
         }
-        if (data_[j_client][i] < low) {
-            data_[j_client][i] = low;
+        if (col[i] < low) {
+            col[i] = low;
         }
     }
+    if (col_sparse_[j_client] || sparse_density_ > 0.0)
+        WriteCol(j_client, col);
 }
-// Modify column of matrix
+
+// Copy column to a dense array
 template <class T>
-void MatrixLoader<T>::IncCol(int j_client, 
-        Eigen::Matrix<T, Eigen::Dynamic, 1> & inc) {
-    std::unique_lock<std::mutex> lck (*(mtx_+j_client));
-    for (int i = 0; i < m_; i++) {
-        data_[j_client][i] += inc(i);
-        if ((data_[j_client][i] > -INFINITESIMAL) 
-                && (data_[j_client][i] < INFINITESIMAL)) {
-            data_[j_client][i] = 0.0;
+void MatrixLoader<T>::ReadCol(int j_client, T * col) {
+    if (out_of_core_) {
+        int num_cols;
+        std::shared_ptr<const std::vector<T> > block = 
+            GetBlock(j_client / block_size_, num_cols);
+        const T * src = block->data() + 
+            size_t(j_client % block_size_) * m_;
+        std::copy(src, src + m_, col);
+        return;
+    }
+    if (precision_ != kFP32) {
+        const std::vector<char> & packed = packed_[j_client];
+        if (precision_ == kInt8) {
+            float scale;
+            memcpy(&scale, packed.data(), sizeof(float));
+            WidenInt8((const int8_t *)(packed.data() + sizeof(float)), m_, 
+                    scale, (float *)col);
+        } else if (precision_ == kFP16) {
+            WidenHalf((const uint16_t *)packed.data(), m_, (float *)col);
+        } else {
+            WidenBFloat((const uint16_t *)packed.data(), m_, (float *)col);
         }
-        if (data_[j_client][i] > MAXELEVAL) {
-            data_[j_client][i] = MAXELEVAL;
+        return;
+    }
+    if (!col_sparse_[j_client]) {
+        std::copy(DenseCol(j_client), DenseCol(j_client) + m_, col);
+        return;
+    }
+    std::fill(col, col + m_, T(0));
+    const std::vector<int> & idx = sparse_idx_[j_client];
+    const std::vector<T> & val = sparse_val_[j_client];
+    for (int p = 0; p < (int)idx.size(); ++p) {
+        col[idx[p]] = val[p];
+    }
+}
+
+// Store a dense array as column, switching storage with hysteresis so that
+// columns around the threshold do not switch back and forth
+template <class T>
+void MatrixLoader<T>::WriteCol(int j_client, const T * col) {
+    int nnz = 0;
+    for (int i = 0; i < m_; ++i) {
+        if (col[i] != 0.0)
+            ++nnz;
+    }
+    T max_density = col_sparse_[j_client]? 2 * sparse_density_: 
+        sparse_density_;
+    std::vector<T> & dense = data_[j_client];
+    std::vector<int> & idx = sparse_idx_[j_client];
+    std::vector<T> & val = sparse_val_[j_client];
+    if (nnz <= max_density * m_) {
+        idx.clear();
+        val.clear();
+        for (int i = 0; i < m_; ++i) {
+            if (col[i] != 0.0) {
+                idx.push_back(i);
+                val.push_back(col[i]);
+            }
         }
-        if (data_[j_client][i] < MINELEVAL) {
-            data_[j_client][i] = MINELEVAL;
+        if (!col_sparse_[j_client]) {
+            std::vector<T>().swap(dense);
+            col_sparse_[j_client] = 1;
         }
+    } else if (col_sparse_[j_client]) {
+        dense.assign(col, col + m_);
+        std::vector<int>().swap(idx);
+        std::vector<T>().swap(val);
+        col_sparse_[j_client] = 0;
+    } else if (col != dense.data()) {
+        std::copy(col, col + m_, dense.begin());
     }
 }
 
-// Modify column of matrix
+// Store a column read from file
 template <class T>
-void MatrixLoader<T>::IncCol(int j_client, 
-        Eigen::Matrix<T, Eigen::Dynamic, 1> & inc, T low) {
-    std::unique_lock<std::mutex> lck (*(mtx_+j_client));
-    for (int i = 0; i < m_; i++) {
-        data_[j_client][i] += inc(i);
-        if ((data_[j_client][i] > -INFINITESIMAL) 
-                && (data_[j_client][i] < INFINITESIMAL)) {
-            data_[j_client][i] = 0.0;
+void MatrixLoader<T>::StoreCol(int j_client, const T * col) {
+    if (out_of_core_) {
+        CHECK_EQ(fwrite(col, sizeof(T), m_, cache_fp_), size_t(m_))
+            << "Fails to write " << cache_file_;
+        return;
+    } else if (precision_ == kFP32) {
+        data_[j_client].assign(col, col + m_);
+        return;
+    }
+    std::vector<char> & packed = packed_[j_client];
+    if (precision_ == kInt8) {
+        // Symmetric scale mapping the largest magnitude to 127
+        float max_abs = 0.0;
+        for (int i = 0; i < m_; ++i) {
+            max_abs = std::max(max_abs, std::abs(float(col[i])));
+        }
+        float scale = max_abs / 127;
+        float inv_scale = (scale > 0.0)? 1 / scale: 0.0;
+        packed.resize(sizeof(float) + m_);
+        memcpy(packed.data(), &scale, sizeof(float));
+        int8_t * q = (int8_t *)(packed.data() + sizeof(float));
+        for (int i = 0; i < m_; ++i) {
+            q[i] = (int8_t)std::lrint(col[i] * inv_scale);
+        }
+    } else {
+        packed.resize(m_ * sizeof(uint16_t));
+        uint16_t * h = (uint16_t *)packed.data();
+        for (int i = 0; i < m_; ++i) {
+            h[i] = (precision_ == kFP16)? FloatToHalf(col[i]): 
+                FloatToBFloat(col[i]);
         }
-        if (data_[j_client][i] > MAXELEVAL) {
-            data_[j_client][i] = MAXELEVAL;
+    }
+    static thread_local std::vector<T> widened;
+    widened.resize(m_);
+    ReadCol(j_client, widened.data());
+    double error = 0.0;
+    for (int i = 0; i < m_; ++i) {
+        error += double(col[i] - widened[i]) * (col[i] - widened[i]);
+    }
+    std::unique_lock<std::mutex> lck(quant_mtx_);
+    quant_error_ += error;
+}
+
+// Allocate storage of columns
+template <class T>
+void MatrixLoader<T>::AllocCols() {
+    data_.resize(client_n_);
+    if (precision_ != kFP32)
+        packed_.resize(client_n_);
+}
+
+// Reopen the cache file for reading by blocks
+template <class T>
+void MatrixLoader<T>::FinishOutOfCore() {
+    if (!out_of_core_)
+        return;
+    fclose(cache_fp_);
+    cache_fp_ = NULL;
+    CHECK((cache_fd_ = open(cache_file_.c_str(), O_RDONLY)) >= 0)
+        << "Fails to open " << cache_file_;
+    num_blocks_ = (client_n_ + block_size_ - 1) / block_size_;
+    long block_bytes = long(block_size_) * m_ * sizeof(T);
+    max_resident_blocks_ = std::max(long(2), max_cache_bytes_ / block_bytes);
+    blocks_.assign(num_blocks_, std::shared_ptr<const std::vector<T> >());
+    block_last_use_.assign(num_blocks_, 0);
+    block_loading_.assign(num_blocks_, 0);
+    block_cycle_.resize(num_blocks_);
+    for (int b = 0; b < num_blocks_; ++b) {
+        block_cycle_[b] = b;
+    }
+    std::mt19937 rng(rand());
+    std::shuffle(block_cycle_.begin(), block_cycle_.end(), rng);
+    LOG(INFO) << "keeping " << client_n_ << " columns out of core in " 
+        << cache_file_ << ", at most " << max_resident_blocks_ << " of " 
+        << num_blocks_ << " blocks of " << block_size_ 
+        << " columns are resident";
+    io_thread_ = std::thread(&MatrixLoader<T>::PrefetchLoop, this);
+}
+
+// Get a block of out-of-core columns
+template <class T>
+std::shared_ptr<const std::vector<T> > MatrixLoader<T>::GetBlock(int block,
+        int & num_cols) {
+    num_cols = std::min(block_size_, client_n_ - block * block_size_);
+    std::unique_lock<std::mutex> lck(block_mtx_);
+    while (!blocks_[block] && block_loading_[block]) {
+        block_cv_.wait(lck);
+    }
+    if (blocks_[block]) {
+        block_last_use_[block] = ++block_clock_;
+        return blocks_[block];
+    }
+    block_loading_[block] = 1;
+    // columns are often visited in order
+    if (block + 1 < num_blocks_) {
+        prefetch_queue_.push_back(block + 1);
+        block_cv_.notify_all();
+    }
+    lck.unlock();
+    return LoadBlock(block);
+}
+
+// Read a block from the cache file
+template <class T>
+std::shared_ptr<const std::vector<T> > MatrixLoader<T>::LoadBlock(int block) {
+    int num_cols = std::min(block_size_, client_n_ - block * block_size_);
+    std::shared_ptr<std::vector<T> > data = 
+        std::make_shared<std::vector<T> >(size_t(num_cols) * m_);
+    size_t bytes = data->size() * sizeof(T), done = 0;
+    off_t offset = off_t(block) * block_size_ * m_ * sizeof(T);
+    while (done < bytes) {
+        ssize_t ret = pread(cache_fd_, (char *)data->data() + done, 
+                bytes - done, offset + done);
+        CHECK_GT(ret, 0) << "Fails to read " << cache_file_;
+        done += ret;
+    }
+    std::unique_lock<std::mutex> lck(block_mtx_);
+    while ((int)resident_blocks_.size() >= max_resident_blocks_) {
+        int victim = 0;
+        for (int p = 1; p < (int)resident_blocks_.size(); ++p) {
+            if (block_last_use_[resident_blocks_[p]] < 
+                    block_last_use_[resident_blocks_[victim]])
+                victim = p;
         }
-        if (data_[j_client][i] < MINELEVAL) {
-            data_[j_client][i] = MINELEVAL;
+        // readers holding the block keep it alive until they are done
+        blocks_[resident_blocks_[victim]].reset();
+        resident_blocks_[victim] = resident_blocks_.back();
+        resident_blocks_.pop_back();
+    }
+    blocks_[block] = data;
+    block_last_use_[block] = ++block_clock_;
+    resident_blocks_.push_back(block);
+    block_loading_[block] = 0;
+    block_cv_.notify_all();
+    return data;
+}
+
+// Prefetch queued blocks until the loader is destroyed
+template <class T>
+void MatrixLoader<T>::PrefetchLoop() {
+    while (true) {
+        std::unique_lock<std::mutex> lck(block_mtx_);
+        block_cv_.wait(lck, [this] { 
+                return io_stop_ || !prefetch_queue_.empty(); });
+        if (io_stop_)
+            return;
+        int block = prefetch_queue_.front();
+        prefetch_queue_.pop_front();
+        if (blocks_[block] || block_loading_[block])
+            continue;
+        block_loading_[block] = 1;
+        lck.unlock();
+        LoadBlock(block);
+    }
+}
+
+// Set density below which columns are stored sparsely
+template <class T>
+void MatrixLoader<T>::SetSparseDensity(T density) {
+    CHECK(mapped_ == NULL || density == 0.0) 
+        << "Mapped columns are stored densely";
+    sparse_density_ = density;
+}
+
+// Count nonzeros and sparse columns
+template <class T>
+void MatrixLoader<T>::GetStorageStats(long & nnz, int & num_sparse_cols) {
+    nnz = 0;
+    num_sparse_cols = 0;
+    for (int j = 0; j < client_n_; ++j) {
+        std::unique_lock<std::mutex> lck (*(mtx_+j));
+        if (col_sparse_[j]) {
+            nnz += sparse_idx_[j].size();
+            ++num_sparse_cols;
+        } else if (!out_of_core_ && precision_ == kFP32) {
+            const T * col = DenseCol(j);
+            for (int i = 0; i < m_; ++i) {
+                if (col[i] != 0.0)
+                    ++nnz;
+            }
         }
-        if (data_[j_client][i] < low) {
-            data_[j_client][i] = low;
+    }
+}
+
+// Record gradient norm of a column
+template <class T>
+void MatrixLoader<T>::SetColGradNorm(int j_client, T grad_norm) {
+    std::unique_lock<std::mutex> lck (*(mtx_+j_client));
+    col_grad_norm_[j_client] = grad_norm;
+    if (sampler_.IsInit()) {
+        sampler_.SetWeight(j_client, 
+                SamplingWeight(col_residual_[j_client], grad_norm));
+    }
+}
+
+// Get last recorded gradient norm of a column
+template <class T>
+T MatrixLoader<T>::GetColGradNorm(int j_client) {
+    std::unique_lock<std::mutex> lck (*(mtx_+j_client));
+    return col_grad_norm_[j_client];
+}
+
+// Lower the priority of converged columns in GetRandCol
+template <class T>
+void MatrixLoader<T>::SetSamplingPriority(T tol, T converged_prob) {
+    converged_tol_ = tol;
+    converged_prob_ = converged_prob;
+}
+
+// Sample columns proportionally to their residuals
+template <class T>
+void MatrixLoader<T>::EnableImportanceSampling(
+        const std::vector<T> & init_residuals, T uniform_mix) {
+    if (client_n_ == 0)
+        return;
+    CHECK_EQ(int(init_residuals.size()), client_n_) 
+        << "Residuals must be given for every column";
+    col_residual_ = init_residuals;
+    std::vector<double> weights(client_n_);
+    for (int j = 0; j < client_n_; ++j) {
+        weights[j] = SamplingWeight(col_residual_[j], col_grad_norm_[j]);
+    }
+    sampler_.Init(weights, uniform_mix);
+}
+
+// Update residual estimate of a column
+template <class T>
+void MatrixLoader<T>::SetColResidual(int j_client, T residual) {
+    if (!sampler_.IsInit())
+        return;
+    std::unique_lock<std::mutex> lck (*(mtx_+j_client));
+    col_residual_[j_client] = residual;
+    sampler_.SetWeight(j_client, 
+            SamplingWeight(residual, col_grad_norm_[j_client]));
+}
+
+// Residual scaled down by the priority of converged columns
+template <class T>
+double MatrixLoader<T>::SamplingWeight(T residual, T grad_norm) {
+    if (grad_norm < converged_tol_)
+        return double(residual) * converged_prob_;
+    return residual;
+}
+
+// Sample a column of a resident block, or any column before the first 
+// block is loaded
+template <class T>
+int MatrixLoader<T>::SampleResidentCol() {
+    if (resident_blocks_.empty())
+        return rand() % client_n_;
+    int block = resident_blocks_[rand() % resident_blocks_.size()];
+    int num_cols = std::min(block_size_, client_n_ - block * block_size_);
+    return block * block_size_ + rand() % num_cols;
+}
+
+// Sample a column id. With importance sampling the weight is exact, 
+// otherwise columns are sampled uniformly, then converged columns are 
+// rejected with probability 1 - converged_prob_. The number of rejections is
+// bounded so that sampling terminates when most columns have converged, and
+// the weight is left 1
+template <class T>
+int MatrixLoader<T>::SampleCol(T & weight) {
+    weight = 1.0;
+    if (out_of_core_) {
+        // Sample a column of a resident block. Every block_size_ samples the
+        // next block of the cycle is prefetched, which evicts the least 
+        // recently used block, so that all columns are visited over time
+        std::unique_lock<std::mutex> lck(block_mtx_);
+        if (num_sampled_++ % block_size_ == 0) {
+            prefetch_queue_.push_back(block_cycle_[next_cycle_block_]);
+            next_cycle_block_ = (next_cycle_block_ + 1) % num_blocks_;
+            block_cv_.notify_all();
         }
+        return SampleResidentCol();
+    }
+    if (sampler_.IsInit()) {
+        double prob;
+        int j_client = sampler_.Sample(prob);
+        weight = 1.0 / (client_n_ * prob);
+        return j_client;
+    }
+    const int max_tries = 16;
+    int j_client = rand() % client_n_;
+    if (converged_prob_ >= 1.0)
+        return j_client;
+    for (int tries = 1; tries < max_tries; ++tries) {
+        if (GetColGradNorm(j_client) >= converged_tol_ || 
+                T(rand()) / RAND_MAX < converged_prob_)
+            break;
+        j_client = rand() % client_n_;
     }
+    return j_client;
 }
 
 template class MatrixLoader<float>;
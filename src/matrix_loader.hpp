@@ -3,8 +3,13 @@
 #include <atomic>
 #include <vector>
 #include <mutex>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <condition_variable>
 
 #include "util/Eigen/Dense"
+#include "column_sampler.hpp"
 
 // Elements whose absolute value is smaller than INFINITESIMAL stored in matrix 
 // would be considered 0 after performing function IncCol() on that column
@@ -33,29 +38,100 @@ class MatrixLoader {
 
         /* Init matrix */
         // Init matrix from unpartitioned file, 
-        // the size of data matrix is m-by-n
+        // the size of data matrix is m-by-n. Files in data_format "nmf" 
+        // (see matrix_format.hpp) or "npy" are read by num_threads threads,
+        // and each client gets a contiguous range of columns instead. Text 
+        // and binary files may be compressed (see compressed_file.hpp), and
+        // are decompressed by num_threads threads. If data_file is a 
+        // directory of shards (see matrix_format.hpp), each in data_format,
+        // the client takes a contiguous range of columns from the shards 
+        // holding them, which are read by num_threads threads
         void Init(std::string data_file, std::string data_format, 
                 int m, int n,
-                int client_id, int num_clients);
+                int client_id, int num_clients, int num_threads = 1);
         // Init matrix from partitioned file, 
         // the size of partial data matrix is m-by-client_n
         void Init(std::string data_file, std::string data_format, 
-                int m, int client_n);
+                int m, int client_n, int num_threads = 1);
+        // Init matrix from sparse file in data_format "libsvm" or "mtx", 
+        // the size of data matrix is m-by-n. Columns are assigned to clients
+        // by number of nonzeros, and are stored sparsely. The file may be 
+        // compressed as above
+        void InitSparse(std::string data_file, std::string data_format, 
+                int m, int n, int client_id, int num_clients, 
+                int num_threads = 1);
         // Init matrix of m-by-client_n with random data ranging from low to high
-        void Init(int m, int client_n, T low, T high);
+        // by num_threads threads. Column j is drawn from its own stream 
+        // seeded by seed and its global column id global_cols[j], or j if 
+        // global_cols is empty
+        void Init(int m, int client_n, T low, T high, unsigned seed, 
+                const std::vector<int> & global_cols, int num_threads = 1);
+        // Init matrix of m-by-client_n backed by the memory mapped file 
+        // map_file, which is updated in place. If keep_existing, the file 
+        // must hold an m-by-client_n matrix, which is mapped as is, otherwise
+        // the file is created and filled with random data as above. Mapped 
+        // columns are stored densely. The file starts with a header of four
+        // int32: the magic number 0x53464D4E, the version 1, m and client_n,
+        // followed by the m * client_n elements in column-major order
+        void InitMapped(std::string map_file, bool keep_existing, int m, 
+                int client_n, T low, T high, unsigned seed, 
+                const std::vector<int> & global_cols, int num_threads = 1);
+        // Whether the matrix is backed by a mapped file
+        bool IsMapped();
+        // Flush the mapped file to disk
+        void Sync();
+
+        /* Out-of-core storage of columns */
+        // Keep the columns in a local file cache_file instead of memory, 
+        // holding at most max_bytes of blocks of block_size consecutive 
+        // columns in an LRU cache. Blocks following a loaded block are 
+        // prefetched by an I/O thread, and GetRandCol samples columns of 
+        // resident blocks, whose set rotates over all blocks. Shall be called
+        // before initializing the matrix from a dense file
+        void SetOutOfCore(std::string cache_file, long max_bytes, 
+                int block_size);
+        bool IsOutOfCore();
+
+        /* Reduced-precision storage of columns */
+        // Keep the elements of a read-only matrix in precision "fp16", 
+        // "bf16" or "int8" scaled per column, or "fp32" as is. Elements are
+        // widened back as columns are read. Shall be called before 
+        // initializing the matrix from a dense file, in memory
+        void SetPrecision(std::string precision);
+        // Average over columns of the squared norm of the error made by 
+        // reducing the precision of a column
+        double GetQuantizationError();
 
         /* Get statistics of matrix */
         int GetM();
         int GetClientN();
+        // Global column ids of columns on given client, which is empty if 
+        // unknown as the data is partitioned
+        const std::vector<int> & GetGlobalCols();
 
         /* Get column of matrix */
         // Get a column of matrix
         bool GetCol(int j_client, std::vector<T> & col);
         bool GetCol(int j_client, Eigen::Matrix<T, Eigen::Dynamic, 1> & col);
+        // Get the sorted indices and values of nonzeros of a column
+        bool GetSparseCol(int j_client, std::vector<int> & idx, 
+                std::vector<T> & val);
         // Get a random column of matrix
         bool GetRandCol(int & j_client, std::vector<T> & col);
         bool GetRandCol(int & j_client, 
                 Eigen::Matrix<T, Eigen::Dynamic, 1> & col);
+        // Get a random column of matrix and the weight 1 / (client_n * p_j)
+        // that makes estimates averaged over sampled columns unbiased, where 
+        // p_j is the probability that column j is sampled
+        bool GetRandCol(int & j_client, 
+                Eigen::Matrix<T, Eigen::Dynamic, 1> & col, T & weight);
+        // Sample a column id and its weight as GetRandCol does, without 
+        // copying the column
+        bool GetRandColId(int & j_client, T & weight);
+        // Sample a column id uniformly, among resident columns if out of 
+        // core, without counting the sample toward prefetches as 
+        // GetRandColId does, e.g. for evaluation
+        bool GetUniformColId(int & j_client);
 
         // Modify column of matrix
         void IncCol(int j_client, std::vector<T> & inc);
@@ -65,14 +141,163 @@ class MatrixLoader {
         void IncCol(int j_client, 
                 Eigen::Matrix<T, Eigen::Dynamic, 1> & inc, T low);
 
+        /* Convergence metadata of columns */
+        // Record the (projected) gradient norm of a column after it has been
+        // optimized, columns never recorded are considered unconverged
+        void SetColGradNorm(int j_client, T grad_norm);
+        T GetColGradNorm(int j_client);
+        // Columns with gradient norm below tol are only accepted with 
+        // probability converged_prob when sampled by GetRandCol
+        void SetSamplingPriority(T tol, T converged_prob);
+
+        /* Importance sampling of columns */
+        // Sample columns proportionally to residuals initialized by 
+        // init_residuals, mixed with uniform sampling with probability 
+        // uniform_mix. Converged columns get their residual scaled by the 
+        // converged_prob of SetSamplingPriority
+        void EnableImportanceSampling(const std::vector<T> & init_residuals, 
+                T uniform_mix);
+        // Update residual estimate of a column
+        void SetColResidual(int j_client, T residual);
+
+        /* Sparse storage of columns */
+        // Columns with at most a fraction density of nonzeros are stored as 
+        // sorted index and value arrays, and sparse columns go back to dense
+        // storage above twice the fraction. Columns switch storage as they 
+        // are modified by IncCol(), 0 keeps all columns dense
+        void SetSparseDensity(T density);
+        // Count nonzeros and sparsely stored columns
+        void GetStorageStats(long & nnz, int & num_sparse_cols);
+
     private:
+        // Init matrix from file in format "nmf", where the client gets the 
+        // client_id-th of num_clients contiguous ranges of columns, and 
+        // chunks holding them are read by num_threads threads
+        void InitNMF(std::string data_file, int m, int n, int client_id, 
+                int num_clients, int num_threads);
+        // Init matrix from 2-D .npy file as above. Columns of float arrays 
+        // in Fortran order are used in place from a read-only mapping of 
+        // the file, other arrays are converted by num_threads threads
+        void InitNpy(std::string data_file, int m, int n, int client_id, 
+                int num_clients, int num_threads);
+        // Init matrix from a directory of shards in data_format
+        void InitShards(std::string data_dir, std::string data_format, 
+                int m, int n, int client_id, int num_clients, 
+                int num_threads);
+        // Read columns col_begin to col_end - 1 of a shard of num_cols 
+        // columns in data_format, storing column j of the shard as column
+        // j - col_begin + first_local
+        void ReadShard(std::string file, std::string data_format, 
+                long num_cols, long col_begin, long col_end, int first_local);
+        // Give the client the client_id-th of num_clients contiguous ranges
+        // of n columns, setting client_n_ and global_cols_, and return the 
+        // first column of the range
+        int AssignColRange(int n, int client_id, int num_clients);
+        // Sample a column id, preferring unconverged columns, and get its
+        // weight for unbiased estimates
+        int SampleCol(T & weight);
+        // Sample a column of a resident block uniformly, with block_mtx_ 
+        // held
+        int SampleResidentCol();
+        // Sampling weight of a column given its residual and gradient norm
+        double SamplingWeight(T residual, T grad_norm);
+        // Add inc to column j_client, zeroing elements smaller than 
+        // INFINITESIMAL and clamping elements to [max(low, MINELEVAL), 
+        // MAXELEVAL]
+        void IncColClamped(int j_client, const T * inc, T low);
+        // Copy column j_client to col of length m_, the caller holds the 
+        // mutex of the column
+        void ReadCol(int j_client, T * col);
+        // Store col of length m_ as column j_client in the storage its 
+        // density calls for, the caller holds the mutex of the column
+        void WriteCol(int j_client, const T * col);
+        // Elements of dense column j_client
+        T * DenseCol(int j_client);
+        // Store a column read by Init, which goes to the cache file if the 
+        // matrix is out of core, or is narrowed to the precision of the 
+        // matrix. Columns may be stored by multiple threads at once
+        void StoreCol(int j_client, const T * col);
+        // Allocate storage of the client_n_ columns read by Init
+        void AllocCols();
+        // Open the cache file for reading and start the I/O thread once all
+        // columns have been stored
+        void FinishOutOfCore();
+        // Get a block of out-of-core columns, loading it if it is not 
+        // resident, and the number of columns in it
+        std::shared_ptr<const std::vector<T> > GetBlock(int block, 
+                int & num_cols);
+        // Read a block from the cache file and make it resident, evicting the
+        // least recently used blocks over the budget. The caller has marked 
+        // the block as loading
+        std::shared_ptr<const std::vector<T> > LoadBlock(int block);
+        // Prefetch blocks queued by GetBlock and SampleCol
+        void PrefetchLoop();
 
     private:
-        // matrix elements are saved in vector <vector <T> >
+        // matrix elements are saved in vector <vector <T> >, which is empty 
+        // for sparse columns
         std::vector<std::vector<T> > data_;
+        // whether each column is sparse, and the sorted indices and values 
+        // of nonzeros of sparse columns, whose capacity is kept as slack
+        std::vector<char> col_sparse_;
+        std::vector<std::vector<int> > sparse_idx_;
+        std::vector<std::vector<T> > sparse_val_;
+        T sparse_density_;
+        // precision of elements and the narrowed columns of a matrix in 
+        // reduced precision, where int8 columns start with their float 
+        // scale, and the sum of squared errors of narrowed columns
+        enum Precision { kFP32, kFP16, kBF16, kInt8 };
+        Precision precision_;
+        std::vector<std::vector<char> > packed_;
+        double quant_error_;
+        std::mutex quant_mtx_;
+        // columns of a mapped matrix, which follow the header of the 
+        // mapping of map_bytes_ at map_addr_, or lie within a read-only 
+        // mapping of an .npy file
+        T * mapped_;
+        void * map_addr_;
+        size_t map_bytes_;
+        std::string map_file_;
         // size of matrix on given client
         int m_, client_n_;
+        // global column id of each column
+        std::vector<int> global_cols_;
         // mutex prevents contension
         std::mutex * mtx_;
+        // last gradient norm of each column
+        std::vector<T> col_grad_norm_;
+        // gradient norm tolerance and the probability of accepting a 
+        // converged column in GetRandCol
+        T converged_tol_, converged_prob_;
+        // last residual estimate of each column and the importance sampler
+        // over them, which is only used if importance sampling is enabled
+        std::vector<T> col_residual_;
+        ColumnSampler sampler_;
+
+        // out-of-core storage: the cache file, blocks in memory, or NULL if 
+        // not resident, the last use of each block by the LRU clock, the 
+        // resident blocks and the blocks being loaded, all guarded by 
+        // block_mtx_
+        bool out_of_core_;
+        std::string cache_file_;
+        FILE * cache_fp_;
+        int cache_fd_;
+        long max_cache_bytes_;
+        int block_size_, num_blocks_, max_resident_blocks_;
+        std::vector<std::shared_ptr<const std::vector<T> > > blocks_;
+        std::vector<long> block_last_use_;
+        long block_clock_;
+        std::vector<int> resident_blocks_;
+        std::vector<char> block_loading_;
+        std::mutex block_mtx_;
+        std::condition_variable block_cv_;
+        // blocks to prefetch, and the shuffled cycle over blocks along which 
+        // residency rotates as columns are sampled
+        std::deque<int> prefetch_queue_;
+        std::vector<int> block_cycle_;
+        int next_cycle_block_;
+        long num_sampled_;
+        std::thread io_thread_;
+        bool io_stop_;
 };
 }; // namespace NMF 
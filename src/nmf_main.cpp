@@ -1,10 +1,13 @@
 #include <petuum_ps_common/include/petuum_ps.hpp>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <string>
 #include <vector>
 #include <thread>
+#include <algorithm>
 
 #include "NMFEngine.hpp"
+#include "matrix_format.hpp"
 #include "util/context.hpp"
 
 /* Petuum Parameters */
@@ -17,14 +20,54 @@ DEFINE_int32(num_comm_channels_per_client, 4,
  
 /* NMF Parameters */
 // Input and Output
-DEFINE_string(data_file, "", "Input matrix.");
+DEFINE_string(data_file, "", "Input matrix. Files in format \"binary\", "
+        "\"text\", \"libsvm\" or \"mtx\" may be compressed by gzip or zstd "
+        "(see src/compressed_file.hpp). Dense matrices may also be given as "
+        "a directory of shards in input_data_format listed by a file "
+        "\"manifest\" (see src/matrix_format.hpp), whose columns are "
+        "assigned to clients in contiguous ranges.");
 DEFINE_string(input_data_format, "", "Format of input matrix file"
-        ", can be \"binary\" or \"text\".");
+        ", can be \"binary\" or \"text\" for dense matrices, \"nmf\" for "
+        "dense matrices in the chunked format with header of "
+        "matrix_format.hpp or \"npy\" for 2-D NumPy arrays of float32 or "
+        "float64 (mapped if float32 in Fortran order), whose columns are "
+        "assigned to clients in contiguous ranges, or "
+        "\"libsvm\" (one line of 1-based row:value pairs per column) or "
+        "\"mtx\" (MatrixMarket coordinate) for sparse matrices, whose "
+        "columns are balanced across clients by number of nonzeros.");
 DEFINE_bool(is_partitioned, false, 
         "Whether or not the input file has been partitioned");
+DEFINE_string(S_map_file, "", "If not empty, S of each client is kept in "
+        "the memory mapped file S_map_file.client_id, which is updated in "
+        "place and flushed instead of writing S to output_path. With "
+        "load_cache, the file of a previous run is mapped as is to resume. "
+        "The file holds a header of four int32, 0x53464D4E, version 1, "
+        "dictionary size and number of columns, followed by S in float32 in "
+        "column-major order. Mapped S is stored densely. Default value is "
+        "empty, which keeps S in memory.");
+DEFINE_double(X_memory_budget, 0.0, "Memory budget of dense data X per "
+        "client in MB. If greater than 0, the columns of X on each client are"
+        " copied to a local file under X_cache_path and kept out of core, with"
+        " blocks of X_block_size columns cached in memory up to the budget. "
+        "Minibatches sample columns of resident blocks, while the blocks "
+        "rotate by prefetching. Requires sampling_mode uniform and "
+        "converged_col_sample_prob 1. Default value is 0, which keeps X in "
+        "memory.");
+DEFINE_int32(X_block_size, 256, "Valid if X_memory_budget is greater than 0."
+        " Number of columns per block of out-of-core X. Default value is "
+        "256.");
+DEFINE_string(X_cache_path, "", "Valid if X_memory_budget is greater than 0."
+        " Local directory of the out-of-core copy of X. Default value is "
+        "output_path.");
+DEFINE_string(X_precision, "fp32", "Precision in which dense data X is kept "
+        "in memory, can be \"fp32\", \"fp16\", \"bf16\" or \"int8\" "
+        "(scaled per column). Elements are widened to fp32 as columns are "
+        "read, and the loss is evaluated against X as stored. fp16 is "
+        "converted by the F16C instructions if built with make "
+        "NMF_USE_F16C=1. Not valid with X_memory_budget.");
 DEFINE_string(output_path, "", "Output path. Must be an existing directory.");
 DEFINE_string(output_data_format, "", "Format of output matrix file"
-        ", can be \"binary\" or \"text\".");
+        ", can be \"binary\", \"text\", \"nmf\" or \"npy\".");
 DEFINE_double(maximum_running_time, -1.0, "Maximum running hours. "
         "Valid if it takes value greater than 0."
         "App will try to terminate when running time exceeds "
@@ -36,10 +79,62 @@ DEFINE_string(cache_path, "", "Valid if load_cache is set to true. "
         "Determine the path of directory containing cache to load B and S.");
 
 // Objective function parameters
-DEFINE_int32(m, 0, "Number of rows in input matrix. ");
-DEFINE_int32(n, 0, "Number of columns in input matrix. ");
+DEFINE_int32(m, 0, "Number of rows in input matrix. "
+        "Taken from the header if 0 and input_data_format is \"nmf\" or "
+        "\"npy\", or from the manifest of a directory of shards.");
+DEFINE_int32(n, 0, "Number of columns in input matrix. "
+        "Taken from the header if 0, input_data_format is \"nmf\" or "
+        "\"npy\" or the input is a directory of shards, and the input is "
+        "not partitioned.");
 DEFINE_int32(dictionary_size, 0, "Size of dictionary. "
         "Default value is number of columns in input matrix.");
+DEFINE_int32(max_dictionary_size, 0, "Upper bound to which the dictionary "
+        "grows from dictionary_size. Whenever the loss plateaus as detected by"
+        " early_stop_tol, dictionary_growth_size atoms are added instead of "
+        "terminating until the bound is reached, so early_stop_tol must be "
+        "greater than 0. B and S are allocated for max_dictionary_size atoms."
+        " Default value is 0, which means the dictionary does not grow.");
+DEFINE_int32(dictionary_growth_size, 0, "Valid if max_dictionary_size is "
+        "greater than dictionary_size. Number of atoms added per growth, each "
+        "initialized with the residual of a sampled column. Default value is "
+        "0, which means a tenth of dictionary_size, rounded up.");
+DEFINE_bool(B_subset_fetch, false, "Whether or not minibatches only fetch "
+        "and update the rows of B of atoms with nonzero coefficients in their "
+        "sampled columns of S, which are the only coefficients updated. Every "
+        "B_full_fetch_interval minibatches, as well as minibatches evaluating "
+        "the loss or estimating step sizes, sweep over all atoms so that atoms"
+        " with positive gradient become nonzero. Not supported with svrg. "
+        "Default value is false.");
+DEFINE_int32(B_full_fetch_interval, 10, "Valid if B_subset_fetch is set to "
+        "true. Number of minibatches per sweep over all atoms. Default value "
+        "is 10.");
+DEFINE_double(sparse_product_density, 0.0, "Columns of S with at most this"
+        " fraction of nonzeros are multiplied with B by gathering the columns"
+        " of B at their nonzeros, and only update these columns of B. -1 "
+        "calibrates the fraction by a benchmark at start-up of each client, "
+        "whose result depends on timing, so that runs are not reproducible. "
+        "Default value is 0, which means always multiplying densely.");
+DEFINE_double(sparse_S_density, 0.25, "Columns of S with at most this "
+        "fraction of nonzeros are stored as sorted indices and values, and go "
+        "back to dense storage above twice the fraction. Columns switch "
+        "storage as they are updated, so memory follows the density of S. "
+        "Default value is 0.25, 0 means dense storage.");
+DEFINE_string(objective, "frobenius", "\"frobenius\": squared error over"
+        " all entries of X. \"masked\": squared error over the entries present"
+        " in sparse input X, treating absent entries as missing instead of 0, "
+        "so that S and B are only fitted and updated at observed entries. "
+        "Requires input_data_format libsvm or mtx and does not support svrg. "
+        "\"kl\": generalized KL divergence of BS from X, whose updates and "
+        "loss only visit the nonzeros of X. Does not support fista, "
+        "auto_step_size or svrg. Default value is frobenius.");
+DEFINE_double(atom_prune_tol, 0.0, "Atoms whose row norm of B, or whose "
+        "contribution to the data, which is the row norm of B times the sum of"
+        " its coefficients over columns visited in the epoch, falls below "
+        "atom_prune_tol times the largest one are pruned at the end of epochs."
+        " Pruned atoms are left out of the computation and the fetch of B, "
+        "their coefficients are zeroed as columns are visited and their rows "
+        "may be reused by dictionary growth. Default value is 0, which means "
+        "no pruning.");
 // Optimization parameters
 DEFINE_int32(num_epochs, 100, "Number of epochs"
         ", where each epoch approximately visit the whole dataset once. "
@@ -69,6 +164,123 @@ DEFINE_double(step_size_offset_S, 100.0, "SGD step size for S at iteration t is"
 DEFINE_double(step_size_pow_S, 0.5, "SGD step size for S at iteration t is "
         "init_step_size * (step_size_offset + t)^(-step_size_pow). "
         "Default value is 0.5.");
+DEFINE_string(S_optimizer, "pgd", "Optimizer for S, can be \"pgd\", "
+        "\"fista\" or \"mu\". \"pgd\" is projected gradient with the step "
+        "size schedule of S. \"fista\" is accelerated projected gradient with "
+        "adaptive restart and step size 1/L, where L is the largest eigenvalue "
+        "of B^T B, halved by backtracking where L is underestimated, and "
+        "ignores the step size parameters of S. \"mu\" is the "
+        "multiplicative update of the kl objective, which also ignores them. "
+        "Default value is \"pgd\".");
+DEFINE_int32(num_power_iter, 10, "Number of power iterations to estimate the "
+        "largest eigenvalue of B^T B per refresh of B. Default value is 10.");
+DEFINE_double(S_convergence_tol, 0.0, "Stop iterating on a column of S within"
+        " a minibatch once its projected gradient norm falls below "
+        "S_convergence_tol. Valid if it takes value greater than 0. "
+        "Default value is 0.0.");
+DEFINE_double(converged_col_sample_prob, 1.0, "Valid if S_convergence_tol is "
+        "greater than 0. A sampled column whose last projected gradient norm "
+        "is below S_convergence_tol is kept with probability "
+        "converged_col_sample_prob and resampled otherwise. "
+        "Default value is 1.0.");
+DEFINE_string(sampling_mode, "uniform", "How to sample columns for "
+        "minibatches, can be \"uniform\" or \"residual\". \"residual\" "
+        "samples columns proportionally to the residual norm of their last "
+        "visit and reweights the gradient of B to keep it unbiased. "
+        "Default value is \"uniform\".");
+DEFINE_double(importance_sampling_uniform_mix, 0.1, "Valid if sampling_mode "
+        "is \"residual\". Probability of sampling a column uniformly "
+        "instead of by residual, which bounds the importance weights. "
+        "Default value is 0.1.");
+DEFINE_string(B_variance_reduction, "none", "Variance reduction of the "
+        "stochastic gradient of B, can be \"none\" or \"svrg\". \"svrg\" "
+        "computes an anchor gradient over the columns on all clients every "
+        "svrg_refresh_epochs epochs and corrects the minibatch gradient by it. "
+        "It keeps an anchor dictionary and an anchor gradient of size "
+        "m * dictionary_size per client and an anchor gradient table of the "
+        "same size, needs a partial anchor gradient of at most that size per "
+        "worker thread while refreshing, and costs about "
+        "svrg_anchor_fraction / svrg_refresh_epochs epochs of extra "
+        "computation. "
+        "Default value is \"none\".");
+DEFINE_int32(svrg_refresh_epochs, 5, "Valid if B_variance_reduction is "
+        "\"svrg\". Refresh the anchor per how many epochs. "
+        "Default value is 5.");
+DEFINE_double(svrg_anchor_fraction, 1.0, "Valid if B_variance_reduction is "
+        "\"svrg\". Fraction of columns used to compute the anchor gradient. "
+        "Default value is 1.0.");
+DEFINE_bool(auto_step_size, false, "Whether or not to choose the initial "
+        "step sizes of B and S automatically, which replace init_step_size_B "
+        "and init_step_size_S. The step size of S is 1/L with L the squared "
+        "spectral norm of B, the step size of B is 1/L with L the squared "
+        "spectral norm of the coefficients of a minibatch divided by "
+        "minibatch_size, both estimated by power iteration. The step sizes "
+        "then decay by their schedules until the next estimation. The step "
+        "size of B is only chosen for B_optimizer \"sgd\". "
+        "Default value is false.");
+DEFINE_int32(auto_step_size_interval, 100, "Valid if auto_step_size is set "
+        "to true. Estimate step sizes per how many minibatches. "
+        "Default value is 100.");
+DEFINE_string(B_optimizer, "sgd", "Optimizer for B, can be \"sgd\", "
+        "\"adagrad\" or \"adam\". The adaptive optimizers scale the step "
+        "size of B per entry by moments of the gradient, which are kept in "
+        "companion tables of the same size as B (\"adagrad\") or twice the "
+        "size of B (\"adam\") with B_optimizer_granularity \"entry\". "
+        "\"adam\" corrects the bias of the moments by the number of updates "
+        "of each row of B, which is exact up to table_staleness except for "
+        "the entries of features left out of masked updates. "
+        "Default value is \"sgd\".");
+DEFINE_string(B_optimizer_granularity, "entry", "Valid if B_optimizer is "
+        "\"adagrad\" or \"adam\". Keep the second moment of the gradient "
+        "per \"entry\" of B or per \"row\" of B, where \"row\" only "
+        "costs dictionary_size floats. Default value is \"entry\".");
+DEFINE_double(adaptive_epsilon, 1e-8, "Constant added to the square root of "
+        "the second moment by the adaptive optimizers of B. "
+        "Default value is 1e-8.");
+DEFINE_double(adam_beta1, 0.9, "Decay rate of the first moment of adam. "
+        "Default value is 0.9.");
+DEFINE_double(adam_beta2, 0.999, "Decay rate of the second moment of adam. "
+        "Default value is 0.999.");
+
+
+DEFINE_double(early_stop_tol, 0.0, "Terminate at the end of an epoch once the "
+        "relative improvement of the smoothed loss averaged over clients "
+        "within the last early_stop_window evaluations falls below "
+        "early_stop_tol, results are saved as usual. Valid if it takes value "
+        "greater than 0, in which case workers synchronize at the end of each "
+        "epoch. Default value is 0.0.");
+DEFINE_int32(early_stop_window, 10, "Valid if early_stop_tol is greater than "
+        "0. Number of evaluations to compare the smoothed loss over. "
+        "Default value is 10.");
+DEFINE_double(early_stop_smoothing, 0.5, "Valid if early_stop_tol is greater "
+        "than 0. Factor of the exponential moving average smoothing the loss, "
+        "0 means no smoothing. Default value is 0.5.");
+
+
+// Initialization parameters
+DEFINE_string(init_method, "random", "How to initialize B and S if load_cache"
+        " is set to false, can be \"random\", \"nndsvd\", "
+        "\"random_columns\" or \"kmeanspp\". \"random\" fills B with "
+        "small random values. \"nndsvd\" initializes B and the sampled "
+        "columns of S by nonnegative double SVD of a randomized truncated SVD "
+        "of a fraction init_sample_fraction of columns, computed jointly by "
+        "all clients, and fills atoms beyond its rank with sampled columns. "
+        "\"random_columns\" and \"kmeanspp\" initialize B with sampled "
+        "columns chosen uniformly or by k-means++ seeding. All but \"random\"" 
+        " run on every worker thread of every client and warm start the rest "
+        "of S by an exact line search along the projected gradient. "
+        "Default value is \"random\".");
+DEFINE_double(init_sample_fraction, 0.1, "Fraction of columns sampled by "
+        "init_method other than \"random\". Default value is 0.1.");
+DEFINE_int32(nndsvd_rank, 0, "Valid if init_method is \"nndsvd\". Rank of "
+        "the truncated SVD, bounded by dictionary_size, m and the number of "
+        "sampled columns. Default value is 0, which means as large as "
+        "possible.");
+DEFINE_int32(random_seed, -1, "Seed of the random initialization of B and "
+        "S. Every row of B and every column of S draws from its own stream "
+        "derived from the seed and its global index, so the initialization "
+        "does not depend on the number of clients and threads. Default value "
+        "is -1, which means seeding from the current time.");
 
 
 /* Misc */
@@ -86,12 +298,31 @@ int main(int argc, char * argv[]) {
     google::ParseCommandLineFlags(&argc, &argv, true);
     google::InitGoogleLogging(argv[0]);
 
+    // Dimensions of files in format "nmf" or "npy" are known from their 
+    // header, those of directories of shards from their manifest. Flags are
+    // set before the context of the engine takes them
+    if ((FLAGS_input_data_format == "nmf" || FLAGS_input_data_format == "npy"
+                || NMF::IsShardDirectory(FLAGS_data_file))
+            && (FLAGS_m == 0 || (FLAGS_n == 0 && !FLAGS_is_partitioned))) {
+        long rows, cols;
+        NMF::GetMatrixFileShape(FLAGS_data_file, FLAGS_input_data_format, 
+                rows, cols);
+        if (FLAGS_m == 0) {
+            google::SetCommandLineOption("m", std::to_string(rows).c_str());
+        }
+        if (FLAGS_n == 0 && !FLAGS_is_partitioned) {
+            google::SetCommandLineOption("n", std::to_string(cols).c_str());
+        }
+        LOG(INFO) << "input matrix is " << FLAGS_m << "-by-" << FLAGS_n;
+    }
+
     petuum::TableGroupConfig table_group_config;
     table_group_config.num_comm_channels_per_client
       = FLAGS_num_comm_channels_per_client;
     table_group_config.num_total_clients = FLAGS_num_clients;
-    // Dictionary table and loss table
-    table_group_config.num_tables = 2;
+    // Dictionary table, loss table, moment tables of B, anchor gradient 
+    // table, scratch table of initialization and atom usage table
+    table_group_config.num_tables = 7;
     // + 1 for main()
     table_group_config.num_local_app_threads = FLAGS_num_worker_threads + 1;;
     table_group_config.client_id = FLAGS_client_id;
@@ -123,14 +354,17 @@ int main(int argc, char * argv[]) {
 
     // Create PS table
     //
-    // B_table (dictionary_size by number of rows in input matrix)
+    // Tables of B are allocated for all atoms the dictionary may grow to
+    int dictionary_capacity = std::max(
+            (FLAGS_dictionary_size == 0? FLAGS_n: FLAGS_dictionary_size), 
+            FLAGS_max_dictionary_size);
+    // B_table (dictionary_capacity by number of rows in input matrix)
     petuum::ClientTableConfig table_config;
     table_config.table_info.row_type = 0;
     table_config.table_info.table_staleness = FLAGS_table_staleness;
     table_config.table_info.row_capacity = FLAGS_m;
     // Assume all rows put into memory
-    table_config.process_cache_capacity = 
-        (FLAGS_dictionary_size == 0? FLAGS_n: FLAGS_dictionary_size);
+    table_config.process_cache_capacity = dictionary_capacity;
     table_config.table_info.row_oplog_type = FLAGS_row_oplog_type;
     table_config.table_info.oplog_dense_serialized = 
         FLAGS_oplog_dense_serialized;
@@ -166,6 +400,68 @@ int main(int argc, char * argv[]) {
     CHECK(petuum::PSTableGroup::CreateTable(1, table_config))
         << "Failed to create loss table";
 
+    // Moment tables of the adaptive optimizers of B. Second moment is 
+    // dictionary_capacity by (m or 1), first moment of adam is 
+    // dictionary_capacity by m + 1, whose last column counts the updates of 
+    // each row. Tables not needed by B_optimizer are kept to 
+    // a single element.
+    bool adaptive_B = (FLAGS_B_optimizer != "sgd");
+    bool adam_B = (FLAGS_B_optimizer == "adam");
+    table_config.table_info.row_type = 0;
+    table_config.table_info.table_staleness = FLAGS_table_staleness;
+    table_config.table_info.row_capacity = 
+        (adaptive_B && FLAGS_B_optimizer_granularity == "entry")? FLAGS_m: 1;
+    table_config.process_cache_capacity = adaptive_B? dictionary_capacity: 1;
+    table_config.table_info.dense_row_oplog_capacity = 
+        table_config.table_info.row_capacity;
+    table_config.thread_cache_capacity = 1;
+    table_config.oplog_capacity = table_config.process_cache_capacity;
+    CHECK(petuum::PSTableGroup::CreateTable(2, table_config))
+        << "Failed to create second moment table";
+
+    table_config.table_info.row_capacity = adam_B? FLAGS_m + 1: 1;
+    table_config.process_cache_capacity = adam_B? dictionary_capacity: 1;
+    table_config.table_info.dense_row_oplog_capacity = 
+        table_config.table_info.row_capacity;
+    table_config.oplog_capacity = table_config.process_cache_capacity;
+    CHECK(petuum::PSTableGroup::CreateTable(3, table_config))
+        << "Failed to create first moment table";
+
+    // Anchor gradient table of svrg, dictionary_capacity by m
+    bool svrg_B = (FLAGS_B_variance_reduction == "svrg");
+    table_config.table_info.row_capacity = svrg_B? FLAGS_m: 1;
+    table_config.process_cache_capacity = svrg_B? dictionary_capacity: 1;
+    table_config.table_info.dense_row_oplog_capacity = 
+        table_config.table_info.row_capacity;
+    table_config.oplog_capacity = table_config.process_cache_capacity;
+    CHECK(petuum::PSTableGroup::CreateTable(4, table_config))
+        << "Failed to create anchor gradient table";
+
+    // Scratch table of nndsvd, (2 * r + 4) by m, where r is bounded by 
+    // min(dictionary_size, m) plus oversampling
+    bool nndsvd = (FLAGS_init_method == "nndsvd" && !FLAGS_load_cache);
+    int nndsvd_r = std::min(
+            (FLAGS_dictionary_size == 0? FLAGS_n: FLAGS_dictionary_size), 
+            FLAGS_m) + 10;
+    table_config.table_info.row_capacity = nndsvd? FLAGS_m: 1;
+    table_config.process_cache_capacity = nndsvd? 2 * nndsvd_r + 4: 1;
+    table_config.table_info.dense_row_oplog_capacity = 
+        table_config.table_info.row_capacity;
+    table_config.oplog_capacity = table_config.process_cache_capacity;
+    CHECK(petuum::PSTableGroup::CreateTable(5, table_config))
+        << "Failed to create initialization table";
+
+    // Atom usage table of pruning, a single row of dictionary_capacity 
+    // accumulating the coefficients of each atom
+    bool prune = (FLAGS_atom_prune_tol > 0.0);
+    table_config.table_info.row_capacity = prune? dictionary_capacity: 1;
+    table_config.process_cache_capacity = 1;
+    table_config.table_info.dense_row_oplog_capacity = 
+        table_config.table_info.row_capacity;
+    table_config.oplog_capacity = 1;
+    CHECK(petuum::PSTableGroup::CreateTable(6, table_config))
+        << "Failed to create atom usage table";
+
     petuum::PSTableGroup::CreateTableDone();
     LOG(INFO) << "Create Table Done!";
 
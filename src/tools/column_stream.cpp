@@ -0,0 +1,331 @@
+#include "column_stream.hpp"
+#include "../compressed_file.hpp"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <glog/logging.h>
+
+namespace NMF {
+
+namespace {
+    // Bytes of text parsed at once
+    const size_t kTextBlockBytes = 16 << 20;
+    // Buffer of binary and text files written
+    const size_t kWriteBufferBytes = 4 << 20;
+
+    // Run f(t) for t = 0 to num_threads - 1 by num_threads threads
+    template <class F>
+    void ParallelFor(int num_threads, F f) {
+        std::vector<std::thread> threads;
+        for (int t = 1; t < num_threads; ++t) {
+            threads.push_back(std::thread(f, t));
+        }
+        f(0);
+        for (auto & thr: threads) {
+            thr.join();
+        }
+    }
+
+    // Parse whitespace-separated numbers of text from begin up to end,
+    // where *end is not part of a number
+    void ParseNumbers(char * begin, char * end, std::string file,
+            std::vector<float> & values) {
+        char * p = begin;
+        while (true) {
+            while (p < end && isspace(*p)) {
+                ++p;
+            }
+            if (p >= end)
+                break;
+            char * q;
+            values.push_back(strtof(p, &q));
+            CHECK(q != p) << "Invalid number in " << file << ": "
+                << std::string(p, std::min<long>(end - p, 20));
+            p = q;
+        }
+    }
+}
+
+// Constructor
+ColumnReader::ColumnReader(): rows_(0), cols_(0), num_threads_(1),
+    num_read_(0), fp_(NULL), next_chunk_(0), pending_begin_(0),
+    at_eof_(false) {
+}
+
+// Deconstructor
+ColumnReader::~ColumnReader() {
+    if (fp_ != NULL)
+        fclose(fp_);
+}
+
+// Open file
+void ColumnReader::Open(std::string file, std::string format, long rows,
+        long cols, int num_threads) {
+    file_ = file;
+    format_ = format;
+    rows_ = rows;
+    cols_ = cols;
+    num_threads_ = std::max(num_threads, 1);
+    if (format == "nmf" || format == "npy") {
+        long file_rows, file_cols;
+        if (format == "nmf") {
+            nmf_reader_.Open(file);
+            file_rows = nmf_reader_.GetRows();
+            file_cols = nmf_reader_.GetCols();
+        } else {
+            npy_reader_.Open(file);
+            file_rows = npy_reader_.GetRows();
+            file_cols = npy_reader_.GetCols();
+        }
+        CHECK((rows == 0 || rows == file_rows)
+                && (cols == 0 || cols == file_cols)) << file << " is "
+            << file_rows << "-by-" << file_cols << " instead of " << rows
+            << "-by-" << cols;
+        rows_ = file_rows;
+        cols_ = file_cols;
+    } else if (format == "binary" || format == "text") {
+        CHECK_GT(rows, 0) << "Number of rows of " << file << " is required";
+        fp_ = OpenDataFile(file, num_threads_);
+        // Compressed files are read through a stream without descriptor
+        struct stat st;
+        if (format == "binary" && cols == 0 && fileno(fp_) >= 0
+                && fstat(fileno(fp_), &st) == 0) {
+            CHECK_EQ(st.st_size % (rows * sizeof(float)), 0) << file
+                << " does not hold columns of " << rows << " elements";
+            cols_ = st.st_size / (rows * sizeof(float));
+        }
+    } else {
+        LOG(FATAL) << "Unrecognized data format: " << format;
+    }
+}
+
+// Get number of rows
+long ColumnReader::GetRows() {
+    return rows_;
+}
+
+// Get number of columns
+long ColumnReader::GetCols() {
+    return cols_;
+}
+
+// Read next columns
+long ColumnReader::Read(long max_cols, std::vector<float> & cols) {
+    if (cols_ > 0)
+        max_cols = std::min(max_cols, cols_ - num_read_);
+    long num_cols = 0;
+    if (format_ == "binary") {
+        cols.resize(max_cols * rows_);
+        num_cols = fread(cols.data(), rows_ * sizeof(float), max_cols, fp_);
+    } else if (format_ == "npy") {
+        // Columns are split evenly among threads
+        num_cols = max_cols;
+        cols.resize(num_cols * rows_);
+        ParallelFor(num_threads_, [&](int t) {
+                long begin = num_cols * t / num_threads_;
+                long end = num_cols * (t + 1) / num_threads_;
+                npy_reader_.ReadCols(num_read_ + begin, num_read_ + end,
+                        cols.data() + begin * rows_);
+            });
+    } else {
+        // Text and chunks of "nmf" files are decoded into pending_ first
+        while (long(pending_.size() - pending_begin_) < max_cols * rows_) {
+            if (format_ == "text") {
+                if (!ParseText())
+                    break;
+            } else {
+                long num_chunks = std::min<long>(num_threads_,
+                        nmf_reader_.GetNumChunks() - next_chunk_);
+                if (num_chunks == 0)
+                    break;
+                std::vector<std::vector<float> > chunks(num_chunks);
+                ParallelFor(num_chunks, [&](int t) {
+                        nmf_reader_.ReadChunk(next_chunk_ + t, chunks[t]);
+                    });
+                for (auto & chunk: chunks) {
+                    pending_.insert(pending_.end(), chunk.begin(),
+                            chunk.end());
+                }
+                next_chunk_ += num_chunks;
+            }
+        }
+        long available = (pending_.size() - pending_begin_) / rows_;
+        num_cols = std::min(max_cols, available);
+        cols.assign(pending_.begin() + pending_begin_,
+                pending_.begin() + pending_begin_ + num_cols * rows_);
+        pending_begin_ += num_cols * rows_;
+        if (pending_begin_ * 2 > pending_.size()) {
+            pending_.erase(pending_.begin(), pending_.begin() + pending_begin_);
+            pending_begin_ = 0;
+        }
+        if (num_cols == 0 && cols_ == 0) {
+            CHECK_EQ(pending_.size(), pending_begin_) << file_
+                << " ends with an incomplete column";
+        }
+    }
+    num_read_ += num_cols;
+    if (num_cols < max_cols && cols_ > 0) {
+        LOG(FATAL) << file_ << " holds only " << num_read_ << " of " 
+            << cols_ << " columns";
+    }
+    cols.resize(num_cols * rows_);
+    return num_cols;
+}
+
+// Parse next block of text, returns false at the end of file
+bool ColumnReader::ParseText() {
+    if (at_eof_)
+        return false;
+    // Text after the last whitespace may be the beginning of a number, and
+    // is kept for the next block
+    size_t end = 0;
+    while (end == 0) {
+        size_t carry = text_.size();
+        text_.resize(carry + kTextBlockBytes);
+        size_t bytes = fread(text_.data() + carry, 1, kTextBlockBytes, fp_);
+        text_.resize(carry + bytes);
+        if (bytes == 0) {
+            at_eof_ = true;
+            end = text_.size();
+            // Terminates the last number
+            text_.push_back('\0');
+            if (end == 0)
+                return false;
+            break;
+        }
+        for (end = text_.size(); end > 0 && !isspace(text_[end - 1]); 
+                --end) {
+        }
+    }
+
+    // The block is split at whitespace among threads, whose numbers are
+    // appended in order
+    std::vector<size_t> bounds(num_threads_ + 1, end);
+    bounds[0] = 0;
+    for (int t = 1; t < num_threads_; ++t) {
+        size_t b = std::max(bounds[t - 1], end * t / num_threads_);
+        while (b < end && !isspace(text_[b])) {
+            ++b;
+        }
+        bounds[t] = b;
+    }
+    std::vector<std::vector<float> > values(num_threads_);
+    ParallelFor(num_threads_, [&](int t) {
+            ParseNumbers(text_.data() + bounds[t], text_.data() + bounds[t + 1],
+                    file_, values[t]);
+        });
+    for (auto & v: values) {
+        pending_.insert(pending_.end(), v.begin(), v.end());
+    }
+    if (at_eof_) {
+        text_.clear();
+    } else {
+        text_.erase(text_.begin(), text_.begin() + end);
+    }
+    return true;
+}
+
+// Constructor
+ColumnWriter::ColumnWriter(): rows_(0), cols_(0), num_threads_(1),
+    num_written_(0), fp_(NULL) {
+}
+
+// Deconstructor
+ColumnWriter::~ColumnWriter() {
+    if (fp_ != NULL)
+        fclose(fp_);
+}
+
+// Create file
+void ColumnWriter::Open(std::string file, std::string format, long rows,
+        long cols, int num_threads) {
+    file_ = file;
+    format_ = format;
+    rows_ = rows;
+    cols_ = cols;
+    num_threads_ = std::max(num_threads, 1);
+    num_written_ = 0;
+    if (format == "nmf") {
+        nmf_writer_.Open(file, rows, cols);
+    } else if (format == "npy") {
+        npy_writer_.Open(file, rows, cols);
+    } else if (format == "binary" || format == "text") {
+        fp_ = fopen(file.c_str(), "wb");
+        CHECK(fp_ != NULL) << "Fails to create " << file;
+        setvbuf(fp_, NULL, _IOFBF, kWriteBufferBytes);
+        text_.resize(num_threads_);
+    } else {
+        LOG(FATAL) << "Unrecognized data format: " << format;
+    }
+}
+
+// Append columns
+void ColumnWriter::Write(const float * cols, long num_cols) {
+    CHECK_LE(num_written_ + num_cols, cols_) << "Too many columns for "
+        << file_;
+    if (format_ == "nmf") {
+        for (long j = 0; j < num_cols; ++j) {
+            nmf_writer_.AppendCol(cols + j * rows_);
+        }
+    } else if (format_ == "npy") {
+        for (long j = 0; j < num_cols; ++j) {
+            npy_writer_.AppendCol(cols + j * rows_);
+        }
+    } else if (format_ == "binary") {
+        CHECK_EQ(fwrite(cols, rows_ * sizeof(float), num_cols, fp_),
+                size_t(num_cols)) << "Fails to write " << file_;
+    } else {
+        // Columns are formatted as by NMFEngine, with more digits where 
+        // needed to read back the same float, split evenly among threads
+        ParallelFor(num_threads_, [&](int t) {
+                std::string & text = text_[t];
+                text.clear();
+                char buf[32];
+                for (long j = num_cols * t / num_threads_;
+                        j < num_cols * (t + 1) / num_threads_; ++j) {
+                    for (long i = 0; i < rows_; ++i) {
+                        float value = cols[j * rows_ + i];
+                        int len = snprintf(buf, sizeof(buf), "%g\t", value);
+                        if (strtof(buf, NULL) != value)
+                            len = snprintf(buf, sizeof(buf), "%.9g\t", value);
+                        text.append(buf, len);
+                    }
+                    text.push_back('\n');
+                }
+            });
+        for (auto & text: text_) {
+            CHECK_EQ(fwrite(text.data(), 1, text.size(), fp_), text.size())
+                << "Fails to write " << file_;
+        }
+    }
+    num_written_ += num_cols;
+}
+
+// Close file
+void ColumnWriter::Close() {
+    if (format_ == "nmf") {
+        nmf_writer_.Close();
+    } else if (format_ == "npy") {
+        npy_writer_.Close();
+    } else {
+        CHECK_EQ(num_written_, cols_) << "Missing columns of " << file_;
+        CHECK_EQ(fclose(fp_), 0) << "Fails to write " << file_;
+        fp_ = NULL;
+    }
+}
+
+// Get file name extension of format
+std::string FormatExtension(std::string format) {
+    if (format == "binary")
+        return "bin";
+    if (format == "text")
+        return "txt";
+    return format;
+}
+}; // namespace NMF
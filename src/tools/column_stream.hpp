@@ -0,0 +1,91 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "../matrix_format.hpp"
+
+// Streaming of the columns of dense matrices in the formats of MatrixLoader,
+// used by the tools partitioning and merging data files. Columns are moved
+// in large blocks, and blocks of text are parsed and formatted by multiple
+// threads
+namespace NMF {
+
+// Sequential reader of the columns of a matrix file in format "binary",
+// "text", "nmf" or "npy". Binary and text files may be compressed (see
+// compressed_file.hpp)
+class ColumnReader {
+    public:
+        ColumnReader();
+        ~ColumnReader();
+
+        // Open file of rows-by-cols, read by num_threads threads. Rows and
+        // cols may be 0 if they are known from the file, the header of files
+        // in format "nmf" or "npy" or the size of uncompressed binary files
+        void Open(std::string file, std::string format, long rows, long cols,
+                int num_threads = 1);
+
+        /* Get statistics of matrix */
+        long GetRows();
+        // Number of columns of the matrix, 0 if unknown
+        long GetCols();
+
+        // Read the next up to max_cols columns into cols in column-major
+        // order. Returns the number of columns read, 0 at the end of file
+        long Read(long max_cols, std::vector<float> & cols);
+
+    private:
+        // Parse the next block of text into pending_
+        bool ParseText();
+
+        std::string file_;
+        std::string format_;
+        long rows_, cols_;
+        int num_threads_;
+        // number of columns read so far
+        long num_read_;
+        FILE * fp_;
+        MatrixFileReader nmf_reader_;
+        NpyFileReader npy_reader_;
+        long next_chunk_;
+        // parsed elements not yet read, and bytes of text after the last
+        // complete number
+        std::vector<float> pending_;
+        size_t pending_begin_;
+        std::vector<char> text_;
+        bool at_eof_;
+};
+
+// Sequential writer of the columns of a matrix file in format "binary",
+// "text", "nmf" or "npy"
+class ColumnWriter {
+    public:
+        ColumnWriter();
+        ~ColumnWriter();
+
+        // Create file for rows-by-cols matrix, text is formatted by
+        // num_threads threads
+        void Open(std::string file, std::string format, long rows, long cols,
+                int num_threads = 1);
+
+        // Append num_cols columns in column-major order
+        void Write(const float * cols, long num_cols);
+
+        // Close file, all columns must have been written
+        void Close();
+
+    private:
+        std::string file_;
+        std::string format_;
+        long rows_, cols_;
+        int num_threads_;
+        long num_written_;
+        FILE * fp_;
+        MatrixFileWriter nmf_writer_;
+        NpyFileWriter npy_writer_;
+        std::vector<std::string> text_;
+};
+
+// File name extension of format, e.g. "bin" for "binary"
+std::string FormatExtension(std::string format);
+}; // namespace NMF
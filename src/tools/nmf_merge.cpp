@@ -0,0 +1,206 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <dirent.h>
+
+#include "column_stream.hpp"
+
+// Merge the per-client files of a matrix written by nmf_main, e.g. the
+// columns of S in S.bin.client_id, into one file, replacing
+// scripts/merge_data.py. Columns are placed by the global column ids of
+// S.cols.client_id if present, and round-robin by client id otherwise.
+// Files of clients are read by multiple threads ahead of the merged block
+// being written
+
+DEFINE_string(output_format, "", "Format of the output file, \"binary\", "
+        "\"text\", \"nmf\" or \"npy\". The format of the input if empty.");
+DEFINE_string(prefix, "S", "Prefix of the names of the files to merge.");
+DEFINE_int32(num_threads, 0, "Number of threads, all cores if 0.");
+DEFINE_int64(block_bytes, 64 << 20, "Bytes of columns moved at once.");
+
+int main(int argc, char * argv[]) {
+    google::SetUsageMessage(std::string("Merge partitioned matrix data "
+                "generated by nmf_main\n\nUsage: ") + argv[0]
+            + " <data-dirname> <data-format> <m> <n> [<output-dirname>]\n\n"
+            "Output: 1 merged file in <output-dirname>, the working directory "
+            "by default.\n<data-dirname> holds files named "
+            "<prefix>*.client_id in <data-format>, \"binary\" or \"text\", "
+            "which may be compressed, \"nmf\" or \"npy\". <m> is the number "
+            "of rows and <n> the number of columns of the merged matrix, "
+            "which may be 0 if known from the files.");
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+    if (argc < 5) {
+        google::ShowUsageWithFlagsRestrict(argv[0], "nmf_merge");
+        return 1;
+    }
+    std::string data_dir = argv[1];
+    std::string data_format = argv[2];
+    long m = atol(argv[3]);
+    long n = atol(argv[4]);
+    std::string output_dir = (argc > 5)? argv[5]: ".";
+    std::string output_format = FLAGS_output_format.empty()?
+        data_format: FLAGS_output_format;
+    int num_threads = (FLAGS_num_threads > 0)? FLAGS_num_threads:
+        std::max<int>(std::thread::hardware_concurrency(), 1);
+
+    // Files are named base_name.client_id, where S.cols.client_id holds
+    // the global column ids of the columns of the client
+    std::string cols_name = FLAGS_prefix + ".cols";
+    std::map<int, std::string> files;
+    std::set<std::string> base_names;
+    DIR * dir = opendir(data_dir.c_str());
+    CHECK(dir != NULL) << "Directory " << data_dir << " does not exist";
+    while (struct dirent * entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        size_t dot = name.rfind('.');
+        if (name.compare(0, FLAGS_prefix.size(), FLAGS_prefix) != 0
+                || dot == std::string::npos || dot + 1 == name.size()
+                || name.find_first_not_of("0123456789", dot + 1)
+                != std::string::npos || name.substr(0, dot) == cols_name)
+            continue;
+        files[atoi(name.c_str() + dot + 1)] = data_dir + "/" + name;
+        base_names.insert(name.substr(0, dot));
+    }
+    closedir(dir);
+    CHECK(!files.empty()) << "No file matching " << FLAGS_prefix
+        << "*.client_id found in " << data_dir;
+    CHECK_EQ(base_names.size(), 1) << "Files of several matrices found in "
+        << data_dir << ", set prefix";
+    int num_clients = files.rbegin()->first + 1;
+    std::vector<NMF::ColumnReader> readers(num_clients);
+    for (int c = 0; c < num_clients; ++c) {
+        CHECK(files.count(c)) << "A complete list of files shall exist, "
+            << *base_names.begin() << "." << c << " does not exist";
+        readers[c].Open(files[c], data_format, m, 0);
+        m = readers[c].GetRows();
+    }
+
+    // Client of each column, increasing global ids of a client are read in
+    // the order of its file
+    std::vector<int> owner;
+    bool has_cols = true;
+    for (int c = 0; c < num_clients; ++c) {
+        has_cols = has_cols && std::ifstream(data_dir + "/" + cols_name + "."
+                + std::to_string(c)).good();
+    }
+    if (has_cols) {
+        std::vector<std::vector<long> > client_cols(num_clients);
+        long max_col = -1;
+        for (int c = 0; c < num_clients; ++c) {
+            std::string cols_file = data_dir + "/" + cols_name + "."
+                + std::to_string(c);
+            std::ifstream fin(cols_file);
+            long col;
+            while (fin >> col) {
+                CHECK(col >= 0 && (client_cols[c].empty()
+                            || col > client_cols[c].back()))
+                    << cols_file << " is not increasing";
+                client_cols[c].push_back(col);
+                max_col = std::max(max_col, col);
+            }
+            CHECK(readers[c].GetCols() == 0
+                    || readers[c].GetCols() == (long)client_cols[c].size())
+                << files[c] << " holds " << readers[c].GetCols()
+                << " columns instead of " << client_cols[c].size();
+        }
+        if (n == 0)
+            n = max_col + 1;
+        owner.assign(n, -1);
+        for (int c = 0; c < num_clients; ++c) {
+            for (long col: client_cols[c]) {
+                CHECK(col < n && owner[col] < 0) << "Column " << col
+                    << " is out of range or held by several clients";
+                owner[col] = c;
+            }
+        }
+        CHECK(std::find(owner.begin(), owner.end(), -1) == owner.end())
+            << "Columns missing from " << cols_name << " files";
+    } else if (n == 0) {
+        for (auto & reader: readers) {
+            CHECK_GT(reader.GetCols(), 0) << "Number of columns is required";
+            n += reader.GetCols();
+        }
+    }
+    auto owner_of = [&](long j) {
+        return owner.empty()? int(j % num_clients): owner[j];
+    };
+
+    // The extension of the format of the input is replaced by that of the
+    // output
+    std::string output_file = *base_names.begin();
+    std::string ext = "." + NMF::FormatExtension(data_format);
+    if (output_file.size() > ext.size() && output_file.compare(
+                output_file.size() - ext.size(), ext.size(), ext) == 0)
+        output_file = output_file.substr(0, output_file.size() - ext.size())
+            + "." + NMF::FormatExtension(output_format);
+    output_file = output_dir + "/" + output_file;
+    NMF::ColumnWriter writer;
+    writer.Open(output_file, output_format, m, n, num_threads);
+
+    // Blocks of the clients are read in parallel, one thread per client at
+    // a time, while the previous merged block is written
+    long block_cols = std::max<long>(FLAGS_block_bytes / (m * sizeof(float)),
+            1);
+    auto read_block = [&](long j0, std::vector<float> & block) {
+        long j1 = std::min(n, j0 + block_cols);
+        std::vector<long> counts(num_clients, 0);
+        for (long j = j0; j < j1; ++j) {
+            ++counts[owner_of(j)];
+        }
+        std::vector<std::vector<float> > client_block(num_clients);
+        std::vector<std::thread> threads(std::min(num_threads, num_clients));
+        int num_readers = threads.size();
+        for (int t = 0; t < num_readers; ++t) {
+            threads[t] = std::thread([&, t]() {
+                for (int c = t; c < num_clients; c += num_readers) {
+                    if (counts[c] > 0) {
+                        CHECK_EQ(readers[c].Read(counts[c], client_block[c]),
+                                counts[c]) << files.at(c) << " holds too few "
+                            "columns";
+                    }
+                }
+            });
+        }
+        for (auto & thr: threads) {
+            thr.join();
+        }
+        block.resize((j1 - j0) * m);
+        std::vector<long> next(num_clients, 0);
+        for (long j = j0; j < j1; ++j) {
+            int c = owner_of(j);
+            std::copy(client_block[c].begin() + next[c] * m,
+                    client_block[c].begin() + (next[c] + 1) * m,
+                    block.begin() + (j - j0) * m);
+            ++next[c];
+        }
+    };
+    auto start = std::chrono::steady_clock::now();
+    std::vector<float> block, next_block;
+    read_block(0, block);
+    for (long j0 = 0; j0 < n; j0 += block_cols) {
+        std::thread read_ahead;
+        if (j0 + block_cols < n)
+            read_ahead = std::thread(read_block, j0 + block_cols,
+                    std::ref(next_block));
+        writer.Write(block.data(), block.size() / m);
+        if (read_ahead.joinable())
+            read_ahead.join();
+        block.swap(next_block);
+    }
+    writer.Close();
+    double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    LOG(INFO) << "merged " << num_clients << " files into " << m << "-by-"
+        << n << " matrix " << output_file << " in " << seconds << " s, "
+        << m * n * sizeof(float) / seconds / (1 << 20) << " MB/s";
+    return 0;
+}
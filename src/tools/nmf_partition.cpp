@@ -0,0 +1,145 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+
+#include "column_stream.hpp"
+
+// Partition a dense matrix by columns into one file per client of nmf_main,
+// replacing scripts/partition_data.py. Blocks of columns are read ahead
+// while the previous block is written, and files of clients are written by
+// multiple threads
+
+DEFINE_string(output_format, "", "Format of output files, \"binary\", "
+        "\"text\", \"nmf\" or \"npy\". The format of the input if empty.");
+DEFINE_bool(contiguous, false, "Give each client a contiguous range of "
+        "columns as nmf_main does for unpartitioned input, and write a "
+        "manifest to output-dirname so that it can be the data_file of an "
+        "unpartitioned run. Otherwise column j goes to client j % num-clients "
+        "as expected by is_partitioned.");
+DEFINE_int32(num_threads, 0, "Number of threads, all cores if 0.");
+DEFINE_int64(block_bytes, 64 << 20, "Bytes of columns moved at once.");
+
+int main(int argc, char * argv[]) {
+    google::SetUsageMessage(std::string("Partition matrix data by columns "
+                "for nmf_main\n\nUsage: ") + argv[0] + " <data-file> "
+            "<data-format> <m> <n> <num-clients> [<output-dirname>]\n\n"
+            "Output: <num-clients> files, ending with \".client_id\".\n"
+            "<data-format> can be \"binary\" or \"text\", which may be "
+            "compressed, \"nmf\" or \"npy\". <m> and <n> are the numbers of "
+            "rows and columns, and may be 0 if known from the file. "
+            "<output-dirname> is the working directory by default.");
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+    if (argc < 6) {
+        google::ShowUsageWithFlagsRestrict(argv[0], "nmf_partition");
+        return 1;
+    }
+    std::string data_file = argv[1];
+    std::string data_format = argv[2];
+    long m = atol(argv[3]);
+    long n = atol(argv[4]);
+    int num_clients = atoi(argv[5]);
+    std::string output_dir = (argc > 6)? argv[6]: ".";
+    std::string output_format = FLAGS_output_format.empty()?
+        data_format: FLAGS_output_format;
+    int num_threads = (FLAGS_num_threads > 0)? FLAGS_num_threads:
+        std::max<int>(std::thread::hardware_concurrency(), 1);
+    CHECK_GT(num_clients, 0) << "Invalid number of clients";
+
+    NMF::ColumnReader reader;
+    reader.Open(data_file, data_format, m, n, num_threads);
+    m = reader.GetRows();
+    n = reader.GetCols();
+    CHECK_GT(n, 0) << "Number of columns of " << data_file << " is required";
+
+    // Clients get as many columns either way, contiguous ranges start at
+    // first_col as in MatrixLoader
+    std::string basename = data_file.substr(data_file.rfind('/') + 1);
+    std::vector<long> client_n(num_clients), first_col(num_clients);
+    std::vector<NMF::ColumnWriter> writers(num_clients);
+    for (int c = 0; c < num_clients; ++c) {
+        client_n[c] = n / num_clients + ((c < n % num_clients)? 1: 0);
+        first_col[c] = c * (n / num_clients) + std::min<long>(c,
+                n % num_clients);
+        // Text of a contiguous range is formatted by all threads, files
+        // of partitions by id are written by one thread each
+        writers[c].Open(output_dir + "/" + basename + "." + std::to_string(c),
+                output_format, m, client_n[c],
+                FLAGS_contiguous? num_threads: 1);
+    }
+
+    long block_cols = std::max<long>(FLAGS_block_bytes / (m * sizeof(float)),
+            1);
+    if (!FLAGS_contiguous)
+        block_cols = (block_cols + num_clients - 1) / num_clients
+            * num_clients;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<float> block, next_block;
+    long num_cols = reader.Read(block_cols, block);
+    long j0 = 0;
+    while (num_cols > 0) {
+        long next_num_cols = 0;
+        std::thread read_ahead([&]() {
+                next_num_cols = reader.Read(block_cols, next_block); });
+        if (FLAGS_contiguous) {
+            for (int c = 0; c < num_clients; ++c) {
+                long begin = std::max(first_col[c], j0);
+                long end = std::min(first_col[c] + client_n[c],
+                        j0 + num_cols);
+                if (begin < end)
+                    writers[c].Write(block.data() + (begin - j0) * m,
+                            end - begin);
+            }
+        } else {
+            // Thread t gathers the columns of clients t, t + num_writers, ...
+            int num_writers = std::min(num_threads, num_clients);
+            std::vector<std::thread> threads(num_writers);
+            for (int t = 0; t < num_writers; ++t) {
+                threads[t] = std::thread([&, t]() {
+                    std::vector<float> cols;
+                    for (int c = t; c < num_clients; c += num_writers) {
+                        cols.clear();
+                        for (long j = (c - j0 % num_clients + num_clients)
+                                % num_clients; j < num_cols;
+                                j += num_clients) {
+                            cols.insert(cols.end(), block.begin() + j * m,
+                                    block.begin() + (j + 1) * m);
+                        }
+                        writers[c].Write(cols.data(), cols.size() / m);
+                    }
+                });
+            }
+            for (auto & thr: threads) {
+                thr.join();
+            }
+        }
+        read_ahead.join();
+        block.swap(next_block);
+        j0 += num_cols;
+        num_cols = next_num_cols;
+    }
+    CHECK_EQ(j0, n) << data_file << " holds only " << j0 << " columns";
+    for (auto & writer: writers) {
+        writer.Close();
+    }
+    if (FLAGS_contiguous) {
+        std::ofstream manifest(output_dir + "/manifest");
+        manifest << m << " " << n << "\n";
+        for (int c = 0; c < num_clients; ++c) {
+            manifest << basename << "." << c << " " << first_col[c] << " "
+                << client_n[c] << "\n";
+        }
+        CHECK(manifest.good()) << "Fails to write manifest to " << output_dir;
+    }
+    double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    LOG(INFO) << "partitioned " << m << "-by-" << n << " matrix into "
+        << num_clients << " files of " << output_dir << " in " << seconds
+        << " s, " << m * n * sizeof(float) / seconds / (1 << 20) << " MB/s";
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include "column_stream.hpp"
+
+// Generate a synthetic nonnegative m-by-n matrix X = B S + noise with known
+// factors, replacing scripts/make_synth_data.py. B is m-by-rank with
+// columns of unit l2 norm, and each column of S holds S_density * rank
+// nonzeros at random atoms. Column j of S and its noise are drawn from a
+// stream seeded by seed and j, so that the data does not depend on the
+// number of threads. Blocks of columns are generated by multiple threads
+// while the previous block is written
+
+DEFINE_string(format, "binary", "Format of output files, \"binary\", "
+        "\"text\", \"nmf\" or \"npy\".");
+DEFINE_double(S_density, 0.1, "Fraction of nonzeros in each column of S, "
+        "at least one.");
+DEFINE_double(noise, 0.0, "Standard deviation of the Gaussian noise added "
+        "to X, which is then clamped to nonnegative values.");
+DEFINE_int32(seed, 1, "Seed of the random streams.");
+DEFINE_bool(ground_truth, true, "Also write B and S next to X.");
+DEFINE_string(prefix, "", "Prefix of the names of the output files, e.g. "
+        "\"sample_\" for sample_X, sample_B and sample_S.");
+DEFINE_int32(num_threads, 0, "Number of threads, all cores if 0.");
+DEFINE_int64(block_bytes, 64 << 20, "Bytes of columns of X generated at "
+        "once.");
+
+int main(int argc, char * argv[]) {
+    google::SetUsageMessage(std::string("Create synthetic data to test "
+                "nmf_main\n\nUsage: ") + argv[0] + " <m> <n> <rank> "
+            "[<output-dirname>]\n\nOutput: X of m-by-n, and the ground "
+            "truth B of m-by-rank and S of rank-by-n, in files <prefix>X, "
+            "<prefix>B and <prefix>S with the extension of the format in "
+            "<output-dirname>, the working directory by default. B and S "
+            "are laid out as written by nmf_main.");
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+    if (argc < 4) {
+        google::ShowUsageWithFlagsRestrict(argv[0], "nmf_synth");
+        return 1;
+    }
+    long m = atol(argv[1]);
+    long n = atol(argv[2]);
+    int rank = atoi(argv[3]);
+    std::string output_dir = (argc > 4)? argv[4]: ".";
+    CHECK(m > 0 && n > 0 && rank > 0) << "Invalid dimensions";
+    int num_threads = (FLAGS_num_threads > 0)? FLAGS_num_threads:
+        std::max<int>(std::thread::hardware_concurrency(), 1);
+    int nnz = std::min(rank, std::max(1,
+                int(std::round(FLAGS_S_density * rank))));
+    std::string ext = "." + NMF::FormatExtension(FLAGS_format);
+    std::string base = output_dir + "/" + FLAGS_prefix;
+    auto start = std::chrono::steady_clock::now();
+
+    // Columns of B are drawn uniformly and normalized
+    std::vector<float> B(m * rank);
+    {
+        std::seed_seq seq{unsigned(FLAGS_seed), 0u};
+        std::mt19937 rng(seq);
+        std::uniform_real_distribution<float> uniform(0.0, 1.0);
+        for (int k = 0; k < rank; ++k) {
+            float * atom = B.data() + long(k) * m;
+            double norm = 0.0;
+            for (long i = 0; i < m; ++i) {
+                atom[i] = uniform(rng);
+                norm += double(atom[i]) * atom[i];
+            }
+            norm = std::sqrt(norm);
+            for (long i = 0; i < m; ++i) {
+                atom[i] /= norm;
+            }
+        }
+    }
+    if (FLAGS_ground_truth) {
+        NMF::ColumnWriter B_writer;
+        B_writer.Open(base + "B" + ext, FLAGS_format, m, rank,
+                num_threads);
+        B_writer.Write(B.data(), rank);
+        B_writer.Close();
+    }
+
+    NMF::ColumnWriter X_writer, S_writer;
+    X_writer.Open(base + "X" + ext, FLAGS_format, m, n, num_threads);
+    if (FLAGS_ground_truth)
+        S_writer.Open(base + "S" + ext, FLAGS_format, rank, n,
+                num_threads);
+    long block_cols = std::max<long>(FLAGS_block_bytes / (m * sizeof(float)),
+            1);
+    // Squared norms of the noise, which is the loss of the ground truth
+    std::vector<double> loss(num_threads, 0.0);
+    auto generate = [&](long j0, std::vector<float> & X_block,
+            std::vector<float> & S_block) {
+        long j1 = std::min(n, j0 + block_cols);
+        X_block.assign((j1 - j0) * m, 0.0);
+        S_block.assign((j1 - j0) * rank, 0.0);
+        std::vector<std::thread> threads(num_threads);
+        for (int t = 0; t < num_threads; ++t) {
+            threads[t] = std::thread([&, t]() {
+                std::vector<int> atoms(rank);
+                std::uniform_real_distribution<float> uniform(0.0, 1.0);
+                std::normal_distribution<float> normal;
+                double thread_loss = 0.0;
+                for (long j = j0 + t; j < j1; j += num_threads) {
+                    std::seed_seq seq{unsigned(FLAGS_seed), 1u,
+                        unsigned(j & 0xFFFFFFFF), unsigned(j >> 32)};
+                    std::mt19937 rng(seq);
+                    float * x = X_block.data() + (j - j0) * m;
+                    float * s = S_block.data() + (j - j0) * rank;
+                    // Distinct atoms by a partial shuffle
+                    for (int k = 0; k < rank; ++k) {
+                        atoms[k] = k;
+                    }
+                    for (int p = 0; p < nnz; ++p) {
+                        std::uniform_int_distribution<int> pick(p, rank - 1);
+                        std::swap(atoms[p], atoms[pick(rng)]);
+                        float value = uniform(rng);
+                        s[atoms[p]] = value;
+                        const float * atom = B.data() + long(atoms[p]) * m;
+                        for (long i = 0; i < m; ++i) {
+                            x[i] += value * atom[i];
+                        }
+                    }
+                    if (FLAGS_noise > 0.0) {
+                        // The spare value of the previous column is dropped
+                        normal.reset();
+                        for (long i = 0; i < m; ++i) {
+                            float clean = x[i];
+                            x[i] = std::max<float>(clean + FLAGS_noise 
+                                    * normal(rng), 0.0);
+                            thread_loss += double(x[i] - clean) 
+                                * (x[i] - clean);
+                        }
+                    }
+                }
+                loss[t] += thread_loss;
+            });
+        }
+        for (auto & thr: threads) {
+            thr.join();
+        }
+    };
+    std::vector<float> X_block, S_block, next_X_block, next_S_block;
+    generate(0, X_block, S_block);
+    for (long j0 = 0; j0 < n; j0 += block_cols) {
+        std::thread generate_ahead;
+        if (j0 + block_cols < n)
+            generate_ahead = std::thread(generate, j0 + block_cols,
+                    std::ref(next_X_block), std::ref(next_S_block));
+        X_writer.Write(X_block.data(), X_block.size() / m);
+        if (FLAGS_ground_truth)
+            S_writer.Write(S_block.data(), S_block.size() / rank);
+        if (generate_ahead.joinable())
+            generate_ahead.join();
+        X_block.swap(next_X_block);
+        S_block.swap(next_S_block);
+    }
+    X_writer.Close();
+    if (FLAGS_ground_truth)
+        S_writer.Close();
+    double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    double total_loss = 0.0;
+    for (double l: loss) {
+        total_loss += l;
+    }
+    LOG(INFO) << "generated " << m << "-by-" << n << " matrix of rank "
+        << rank << " with " << nnz << " nonzeros per column of S in "
+        << output_dir << " in " << seconds << " s, "
+        << m * n * sizeof(float) / seconds / (1 << 20) << " MB/s";
+    LOG(INFO) << "average loss of the ground truth: " << total_loss / n;
+    return 0;
+}